@@ -0,0 +1,296 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace SW3D
+{
+  namespace
+  {
+    //
+    // What items without bounds get, so that they're never culled.
+    //
+    AABB Everywhere()
+    {
+      AABB res;
+
+      res.Min = { -std::numeric_limits<double>::max(),
+                  -std::numeric_limits<double>::max(),
+                  -std::numeric_limits<double>::max() };
+
+      res.Max = {  std::numeric_limits<double>::max(),
+                   std::numeric_limits<double>::max(),
+                   std::numeric_limits<double>::max() };
+
+      return res;
+    }
+
+    // -------------------------------------------------------------------------
+
+    bool SameBounds(const AABB& a, const AABB& b)
+    {
+      return (a.Min.X == b.Min.X and a.Min.Y == b.Min.Y and a.Min.Z == b.Min.Z
+          and a.Max.X == b.Max.X and a.Max.Y == b.Max.Y and a.Max.Z == b.Max.Z);
+    }
+  }
+
+  // ===========================================================================
+
+  void BVH::Build(const std::vector<AABB>& bounds)
+  {
+    _nodes.clear();
+    _items.clear();
+
+    _bounds = bounds;
+
+    for (AABB& box : _bounds)
+    {
+      if (box.IsEmpty())
+      {
+        box = Everywhere();
+      }
+    }
+
+    if (_bounds.empty())
+    {
+      _leafByItem.clear();
+      return;
+    }
+
+    _items.resize(_bounds.size());
+    _leafByItem.resize(_bounds.size());
+
+    for (uint32_t i = 0; i < _items.size(); i++)
+    {
+      _items[i] = i;
+    }
+
+    _nodes.reserve(2 * (_items.size() / kMaxLeafItems + 1));
+
+    BuildNode(0, _items.size(), -1);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void BVH::Build(const ModelLoader::Scene& scene)
+  {
+    std::vector<AABB> bounds;
+
+    bounds.reserve(scene.Objects.size());
+
+    for (const ModelLoader::Scene::Object& obj : scene.Objects)
+    {
+      bounds.push_back(obj.Bounds);
+    }
+
+    Build(bounds);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  AABB BVH::ItemsBounds(uint32_t first, uint32_t count) const
+  {
+    AABB res;
+
+    for (uint32_t i = first; i < first + count; i++)
+    {
+      const AABB& box = _bounds[_items[i]];
+
+      res.Add(box.Min);
+      res.Add(box.Max);
+    }
+
+    return res;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  int32_t BVH::BuildNode(uint32_t first, uint32_t count, int32_t parent)
+  {
+    int32_t index = _nodes.size();
+
+    _nodes.push_back(Node());
+
+    Node& node = _nodes.back();
+
+    node.Parent = parent;
+    node.First  = first;
+    node.Count  = count;
+    node.Bounds = ItemsBounds(first, count);
+
+    if (count <= kMaxLeafItems)
+    {
+      for (uint32_t i = first; i < first + count; i++)
+      {
+        _leafByItem[_items[i]] = index;
+      }
+
+      return index;
+    }
+
+    //
+    // Split in half along the axis where centers of boxes are spread out
+    // the most. Halving keeps the tree balanced no matter what.
+    //
+    AABB centers;
+
+    auto center = [this](uint32_t item)
+    {
+      const AABB& box = _bounds[item];
+      return (box.Min + box.Max) * 0.5;
+    };
+
+    for (uint32_t i = first; i < first + count; i++)
+    {
+      centers.Add(center(_items[i]));
+    }
+
+    Vec3 extent = centers.Max - centers.Min;
+
+    int axis = 0;
+
+    if (extent.Y > extent.X)
+    {
+      axis = 1;
+    }
+
+    if (extent.Z > std::max(extent.X, extent.Y))
+    {
+      axis = 2;
+    }
+
+    auto coord = [axis](const Vec3& v)
+    {
+      return (axis == 0) ? v.X : (axis == 1) ? v.Y : v.Z;
+    };
+
+    uint32_t mid = first + count / 2;
+
+    std::nth_element(_items.begin() + first,
+                     _items.begin() + mid,
+                     _items.begin() + first + count,
+                     [&center, &coord](uint32_t a, uint32_t b)
+                     {
+                       return coord(center(a)) < coord(center(b));
+                     });
+
+    //
+    // Recursion may reallocate nodes, so no references past this point.
+    //
+    int32_t left  = BuildNode(first, mid - first, index);
+    int32_t right = BuildNode(mid, first + count - mid, index);
+
+    _nodes[index].Left  = left;
+    _nodes[index].Right = right;
+
+    return index;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void BVH::Refit(uint32_t item, const AABB& bounds)
+  {
+    if (item >= _bounds.size())
+    {
+      return;
+    }
+
+    _bounds[item] = bounds.IsEmpty() ? Everywhere() : bounds;
+
+    int32_t index = _leafByItem[item];
+
+    while (index != -1)
+    {
+      Node& node = _nodes[index];
+
+      AABB box;
+
+      if (node.Left == -1)
+      {
+        box = ItemsBounds(node.First, node.Count);
+      }
+      else
+      {
+        const AABB& l = _nodes[node.Left].Bounds;
+        const AABB& r = _nodes[node.Right].Bounds;
+
+        box = l;
+        box.Add(r.Min);
+        box.Add(r.Max);
+      }
+
+      if (SameBounds(box, node.Bounds))
+      {
+        break;
+      }
+
+      node.Bounds = box;
+
+      index = node.Parent;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void BVH::Query(const Frustum& frustum, std::vector<uint32_t>& visible) const
+  {
+    visible.clear();
+
+    if (_nodes.empty())
+    {
+      return;
+    }
+
+    int32_t stack[kMaxDepth];
+    size_t top = 0;
+
+    stack[top++] = 0;
+
+    while (top != 0)
+    {
+      const Node& node = _nodes[stack[--top]];
+
+      FrustumTest res = frustum.Test(node.Bounds);
+
+      if (res == FrustumTest::OUTSIDE)
+      {
+        continue;
+      }
+
+      if (res == FrustumTest::INSIDE)
+      {
+        visible.insert(visible.end(),
+                       _items.begin() + node.First,
+                       _items.begin() + node.First + node.Count);
+        continue;
+      }
+
+      if (node.Left == -1)
+      {
+        for (uint32_t i = node.First; i < node.First + node.Count; i++)
+        {
+          uint32_t item = _items[i];
+
+          if (frustum.Test(_bounds[item]) != FrustumTest::OUTSIDE)
+          {
+            visible.push_back(item);
+          }
+        }
+
+        continue;
+      }
+
+      stack[top++] = node.Right;
+      stack[top++] = node.Left;
+    }
+
+    std::sort(visible.begin(), visible.end());
+  }
+
+  // ---------------------------------------------------------------------------
+
+  size_t BVH::Size() const
+  {
+    return _bounds.size();
+  }
+}
@@ -0,0 +1,87 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+
+#include "types.h"
+#include "model-loader.h"
+
+namespace SW3D
+{
+  //
+  // Bounding volume hierarchy over boxes of some items (usually objects of
+  // a scene), so that finding the ones that can be visible costs about as
+  // much as there are visible ones, not as much as there are items total.
+  //
+  class BVH
+  {
+    public:
+      //
+      // Item i is the one with bounds[i], and that's what queries return.
+      // Items with empty bounds are considered to be everywhere.
+      //
+      void Build(const std::vector<AABB>& bounds);
+
+      //
+      // Items are scene objects in the order they're in the scene.
+      //
+      void Build(const ModelLoader::Scene& scene);
+
+      //
+      // Item has moved: its box is replaced and boxes above it are updated
+      // up to the first one that hasn't changed. Tree structure stays the
+      // same, so if things move around a lot it's worth to Build() it again
+      // once in a while.
+      //
+      void Refit(uint32_t item, const AABB& bounds);
+
+      //
+      // Indices of items that are not outside of the frustum, ascending, so
+      // that drawing them in that order doesn't change drawing order.
+      // Subtrees that are completely inside are taken as is, without testing
+      // anything below them.
+      //
+      void Query(const Frustum& frustum, std::vector<uint32_t>& visible) const;
+
+      size_t Size() const;
+
+    private:
+      struct Node
+      {
+        AABB Bounds;
+
+        //
+        // -1 for leaves.
+        //
+        int32_t Left  = -1;
+        int32_t Right = -1;
+
+        int32_t Parent = -1;
+
+        //
+        // Items of the whole subtree are _items[First, First + Count).
+        //
+        uint32_t First = 0;
+        uint32_t Count = 0;
+      };
+
+      static constexpr uint32_t kMaxLeafItems = 4;
+
+      //
+      // Tree is split in half at every level, so it can't be deeper than
+      // that with 32 bit item indices.
+      //
+      static constexpr size_t kMaxDepth = 64;
+
+      int32_t BuildNode(uint32_t first, uint32_t count, int32_t parent);
+
+      AABB ItemsBounds(uint32_t first, uint32_t count) const;
+
+      std::vector<Node>     _nodes;
+      std::vector<uint32_t> _items;
+      std::vector<AABB>     _bounds;
+      std::vector<int32_t>  _leafByItem;
+  };
+}
+
+#endif // BVH_H
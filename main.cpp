@@ -32,9 +32,11 @@
 // by yourself as they arise.
 //
 #include "sw3d.h"
+#include "bvh.h"
 #include "instant-font.h"
 
 #include <map>
+#include <charconv>
 
 #define PRINTL(x, y, format, ...)                                    \
   IF::Instance().Printf(x, y,                                        \
@@ -134,8 +136,20 @@ const uint32_t DebugColor = 0xAAAAAA;
 
 const double InitialTranslation = 5.0;
 
+//
+// Orthographic projection keeps only what's within that distance along Z
+// (both ways), so it has to cover objects pushed away with Q / E too.
+//
+const double OrthographicDepth = InitialTranslation * 4.0;
+
 SW3D::ModelLoader Loader;
 
+//
+// Objects of loaded model, so that only visible ones are drawn.
+//
+SW3D::BVH LoaderTree;
+std::vector<uint32_t> VisibleObjects;
+
 int ModelIndex = 0;
 
 const std::vector<std::string> ModelsList =
@@ -146,17 +160,44 @@ const std::vector<std::string> ModelsList =
   "models/teapot.obj"
 };
 
+bool LoadModel()
+{
+  bool ok = Loader.Load(ModelsList[ModelIndex]);
+
+  if (not ok)
+  {
+    //
+    // Tree of the previous model would point at objects that are gone.
+    //
+    LoaderTree = SW3D::BVH();
+    return false;
+  }
+
+  LoaderTree.Build(Loader.GetScene());
+
+  for (const auto& obj : Loader.GetScene().Objects)
+  {
+    SDL_Log("%s: ACMR %.3f -> %.3f, %zu LODs",
+            obj.Name.data(), obj.ACMRBefore, obj.ACMRAfter, obj.Lods.size());
+  }
+
+  return true;
+}
+
 const std::string kAxesFname = "models/axes.obj";
 SW3D::ModelLoader Axes;
 
 const std::string kCubeFname = "models/cube.obj";
 SW3D::ModelLoader Cube;
 
+const std::string kTexturedCubeFname = "models/cube-textured.obj";
+SW3D::ModelLoader TexturedCube;
+
 const std::vector<std::string> HelpText =
 {
   "ESC   - exit",
   "TAB   - cycle render modes",
-  "1-5   - switch scenes",
+  "1-6   - switch scenes",
   "WASD  - move objects (where applicable)",
   "Q E   - move object along Z",
   "SPACE - toggle pause",
@@ -181,7 +222,7 @@ class Drawer : public DrawWrapper
         case ProjectionMode::ORTHOGRAPHIC:
           SetOrthographic(-InitialTranslation * 0.5,  InitialTranslation * 0.5,
                            InitialTranslation * 0.5, -InitialTranslation * 0.5,
-                           InitialTranslation * 0.5, -InitialTranslation * 0.5);
+                           OrthographicDepth,        -OrthographicDepth);
           break;
 
         case ProjectionMode::WEAK_PERSPECTIVE:
@@ -308,7 +349,24 @@ class Drawer : public DrawWrapper
         { 1.0, 0.0, 0.0,    0.0, 0.0, 1.0,    1.0, 0.0, 1.0 },
       };
 
-      bool ok = Loader.Load(ModelsList[ModelIndex]);
+      //
+      // Everything is drawn with DrawIndexed() or straight from faces,
+      // so expanded triangles are not needed.
+      //
+      for (SW3D::ModelLoader* l : { &Loader, &Axes, &Cube, &TexturedCube })
+      {
+        l->SetCacheEnabled(true);
+        l->SetMeshOutput(SW3D::MeshOutput::INDEXED);
+        l->SetOptimizeVertexCache(true);
+        l->SetLodLevels(3);
+      }
+
+      //
+      // Objects smaller than that on screen are drawn with coarser LODs.
+      //
+      SetLodThreshold(64.0);
+
+      bool ok = LoadModel();
       if (not ok)
       {
         SDL_Log("%s", SW3D::ErrorToString());
@@ -326,6 +384,12 @@ class Drawer : public DrawWrapper
         SDL_Log("%s", SW3D::ErrorToString());
       }
 
+      ok = TexturedCube.Load(kTexturedCubeFname);
+      if (not ok)
+      {
+        SDL_Log("%s", SW3D::ErrorToString());
+      }
+
       CheckerBoardTexture = LoadTexture("textures/checker.bmp");
       if (CheckerBoardTexture == -1)
       {
@@ -477,7 +541,7 @@ class Drawer : public DrawWrapper
                   ModelIndex = ModelsList.size() - 1;
                 }
 
-                bool ok = Loader.Load(ModelsList[ModelIndex]);
+                bool ok = LoadModel();
                 if (not ok)
                 {
                   SDL_Log("%s", SW3D::ErrorToString());
@@ -489,7 +553,7 @@ class Drawer : public DrawWrapper
               {
                 ModelIndex++;
                 ModelIndex %= ModelsList.size();
-                bool ok = Loader.Load(ModelsList[ModelIndex]);
+                bool ok = LoadModel();
                 if (not ok)
                 {
                   SDL_Log("%s", SW3D::ErrorToString());
@@ -570,7 +634,7 @@ class Drawer : public DrawWrapper
           // draw triangles based on those vertices using faces enumeration.
           // We'll do exactly like that when we load model from .obj file.
           //
-          tp.Points[i] = _projectionMatrix * tt.Points[i];
+          tp.Points[i] = GetProjectionMatrix() * tt.Points[i];
 
           //
           // TODO: temporary hack to place (0;0) at the center of the screen.
@@ -637,7 +701,7 @@ class Drawer : public DrawWrapper
 
             const Vec3& v = Loader.GetScene().Vertices[vertexInd];
 
-            tr.Points[i].Position = (_modelViewMatrix * v);
+            tr.Points[i].Position = (GetModelViewMatrix() * v);
           }
 
           if (CullFaceMode_ != CullFaceMode::NONE)
@@ -651,7 +715,8 @@ class Drawer : public DrawWrapper
 
           for (size_t i = 0; i < 3; i++)
           {
-            tr.Points[i].Position = (_projectionMatrix * tr.Points[i].Position);
+            tr.Points[i].Position = (GetProjectionMatrix()
+                                   * tr.Points[i].Position);
 
             tr.Points[i].Position.X += 1;
             tr.Points[i].Position.Y += 1;
@@ -704,11 +769,7 @@ class Drawer : public DrawWrapper
             int32_t vertexInd = face.Indices[i][0];
             Vec3 v = Axes.GetScene().Vertices[vertexInd];
 
-            //
-            // NOTE: without parentheses it's actually an order of magnitude
-            // slower.
-            //
-            tr.Points[i].Position = _projectionMatrix * (_modelViewMatrix * v);
+            tr.Points[i].Position = GetModelViewProjection() * v;
 
             tr.Points[i].Position.X += 1;
             tr.Points[i].Position.Y += 1;
@@ -744,6 +805,8 @@ class Drawer : public DrawWrapper
         ClearDepthBuffer();
       }
 
+      SetDepthTestEnabled(DepthTest);
+
       PushMatrix();
 
       //
@@ -756,20 +819,21 @@ class Drawer : public DrawWrapper
 
       Translate(DX, DY, (InitialTranslation + DZ));
 
-      for (auto& obj : Loader.GetScene().Objects)
+      LoaderTree.Query(GetFrustum(), VisibleObjects);
+
+      for (uint32_t i : VisibleObjects)
       {
-        for (auto& tri : obj.Triangles)
-        {
-          //
-          // Add to rendering queue with current modelview and projection
-          // matrices.
-          //
-          Enqueue(tri);
-        }
+        //
+        // Add to rendering queue with current modelview and projection
+        // matrices.
+        //
+        DrawIndexed(Loader.GetScene(), Loader.GetScene().Objects[i]);
       }
 
       PopMatrix();
 
+      SetDepthTestEnabled(false);
+
       /*
       PushMatrix();
 
@@ -820,7 +884,7 @@ class Drawer : public DrawWrapper
 
       SetOrthographic(-InitialTranslation * 0.5,  InitialTranslation * 0.5,
                        InitialTranslation * 0.5, -InitialTranslation * 0.5,
-                       InitialTranslation * 0.5, -InitialTranslation * 0.5);
+                       OrthographicDepth,        -OrthographicDepth);
 
       SetMatrixMode(MatrixMode::MODELVIEW);
       PushMatrix();
@@ -833,10 +897,7 @@ class Drawer : public DrawWrapper
 
       for (auto& obj : Cube.GetScene().Objects)
       {
-        for (auto& tri : obj.Triangles)
-        {
-          Enqueue(tri);
-        }
+        DrawIndexed(Cube.GetScene(), obj);
       }
 
       PopMatrix();
@@ -851,14 +912,49 @@ class Drawer : public DrawWrapper
 
       for (auto& obj : Cube.GetScene().Objects)
       {
-        for (auto& tri : obj.Triangles)
-        {
-          Enqueue(tri);
-        }
+        DrawIndexed(Cube.GetScene(), obj);
+      }
+
+      PopMatrix();
+
+      CommenceDraw();
+
+      if (not Paused)
+      {
+        angle += (RotationSpeed * DeltaTime());
+      }
+    }
+
+    // -------------------------------------------------------------------------
+
+    void Textured()
+    {
+      static double angle = 0.0;
+
+      ClearDepthBuffer();
+      SetDepthTestEnabled(true);
+
+      PushMatrix();
+
+      RotateZ(0.5   * angle);
+      RotateY(0.25  * angle);
+      RotateX(0.125 * angle);
+
+      Translate(DX, DY, (InitialTranslation + DZ));
+
+      SetTexture(CheckerBoardTexture);
+
+      for (auto& obj : TexturedCube.GetScene().Objects)
+      {
+        DrawIndexed(TexturedCube.GetScene(), obj);
       }
 
+      SetTexture(-1);
+
       PopMatrix();
 
+      SetDepthTestEnabled(false);
+
       CommenceDraw();
 
       if (not Paused)
@@ -898,7 +994,7 @@ class Drawer : public DrawWrapper
           PRINTR(WindowWidth - 60 * (3 - y),
                  WindowHeight - 30 * (4 - x),
                  "%.2f  ",
-                 _projectionMatrix[x][y]);
+                 GetProjectionMatrix()[x][y]);
         }
       }
 
@@ -996,6 +1092,10 @@ class Drawer : public DrawWrapper
         case AppMode::TWO_PROJECTIONS:
           TwoProjections();
           break;
+
+        case AppMode::TEXTURED:
+          Textured();
+          break;
       }
     }
 
@@ -1005,10 +1105,102 @@ class Drawer : public DrawWrapper
 
 // =============================================================================
 
+const char* kUsage = "usage: sw-3d [--headless <frames>] [--scene <1-6>]"
+                     " [--dump <prefix>] [--bmp] [--threads <N>]";
+
+//
+// Whole string has to be a number, no exceptions thrown either way.
+//
+template <typename T>
+bool ParseNumber(const std::string& str, T& res)
+{
+  const char* end = str.data() + str.length();
+
+  auto [ptr, ec] = std::from_chars(str.data(), end, res);
+
+  return (ec == std::errc() and ptr == end);
+}
+
+// =============================================================================
+
+//
+// Without arguments runs in a window as usual. For rendering without display:
+//
+// sw-3d --headless <frames> [--scene <1-6>] [--dump <prefix>] [--bmp]
+//       [--threads <N>]
+//
 int main(int argc, char* argv[])
 {
   Drawer d;
 
+  size_t headlessFrames = 0;
+
+  std::string dumpPrefix;
+  ImageFormat dumpFormat = ImageFormat::PPM;
+
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+
+    if (arg == "--headless" and i + 1 < argc)
+    {
+      if (not ParseNumber(argv[++i], headlessFrames))
+      {
+        SDL_Log("Bad number of frames '%s'\n%s", argv[i], kUsage);
+        return 1;
+      }
+    }
+    else if (arg == "--scene" and i + 1 < argc)
+    {
+      int scene = 0;
+
+      if (not ParseNumber(argv[++i], scene)
+       or scene < 1
+       or scene > (int)AppModes.size())
+      {
+        SDL_Log("Bad scene '%s'\n%s", argv[i], kUsage);
+        return 1;
+      }
+
+      ApplicationMode = (AppMode)(scene - 1);
+    }
+    else if (arg == "--dump" and i + 1 < argc)
+    {
+      dumpPrefix = argv[++i];
+    }
+    else if (arg == "--bmp")
+    {
+      dumpFormat = ImageFormat::BMP;
+    }
+    else if (arg == "--threads" and i + 1 < argc)
+    {
+      size_t threads = 0;
+
+      if (not ParseNumber(argv[++i], threads))
+      {
+        SDL_Log("Bad number of threads '%s'\n%s", argv[i], kUsage);
+        return 1;
+      }
+
+      d.SetThreadCount(threads);
+    }
+    else
+    {
+      SDL_Log("Unknown argument '%s'", arg.data());
+    }
+  }
+
+  if (headlessFrames != 0)
+  {
+    if ( d.InitHeadless(WW, WH, headlessFrames, QualityReductionFactor) )
+    {
+      d.SetFrameDump(dumpPrefix, dumpFormat);
+      d.Run();
+    }
+
+    return 0;
+  }
+
   if ( d.Init(WW, WH, QualityReductionFactor) )
   {
     IF::Instance().Init(d.GetRenderer());
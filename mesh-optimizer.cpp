@@ -0,0 +1,727 @@
+#include "mesh-optimizer.h"
+
+#include <limits>
+#include <numeric>
+#include <algorithm>
+
+namespace SW3D
+{
+  namespace
+  {
+    //
+    // Sum of squared distances to some planes as a function of a point:
+    // for plane ax + by + cz + d = 0 it's (ax + by + cz + d)^2.
+    //
+    struct Quadric
+    {
+      double A2 = 0.0;
+      double AB = 0.0;
+      double AC = 0.0;
+      double AD = 0.0;
+      double B2 = 0.0;
+      double BC = 0.0;
+      double BD = 0.0;
+      double C2 = 0.0;
+      double CD = 0.0;
+      double D2 = 0.0;
+
+      void AddPlane(const Vec3& n, double d, double weight)
+      {
+        A2 += weight * n.X * n.X;
+        AB += weight * n.X * n.Y;
+        AC += weight * n.X * n.Z;
+        AD += weight * n.X * d;
+        B2 += weight * n.Y * n.Y;
+        BC += weight * n.Y * n.Z;
+        BD += weight * n.Y * d;
+        C2 += weight * n.Z * n.Z;
+        CD += weight * n.Z * d;
+        D2 += weight * d * d;
+      }
+
+      void Add(const Quadric& q)
+      {
+        A2 += q.A2;
+        AB += q.AB;
+        AC += q.AC;
+        AD += q.AD;
+        B2 += q.B2;
+        BC += q.BC;
+        BD += q.BD;
+        C2 += q.C2;
+        CD += q.CD;
+        D2 += q.D2;
+      }
+
+      double Error(const Vec3& p) const
+      {
+        return A2 * p.X * p.X + B2 * p.Y * p.Y + C2 * p.Z * p.Z
+             + 2.0 * (AB * p.X * p.Y + AC * p.X * p.Z + BC * p.Y * p.Z)
+             + 2.0 * (AD * p.X + BD * p.Y + CD * p.Z)
+             + D2;
+      }
+    };
+
+    // -------------------------------------------------------------------------
+
+    //
+    // Not normalized, so its length is twice the area.
+    //
+    Vec3 TriangleNormal(const Vec3& a, const Vec3& b, const Vec3& c)
+    {
+      Vec3 u = b - a;
+      Vec3 v = c - a;
+
+      return { u.Y * v.Z - u.Z * v.Y,
+               u.Z * v.X - u.X * v.Z,
+               u.X * v.Y - u.Y * v.X };
+    }
+
+    // -------------------------------------------------------------------------
+
+    double Dot(const Vec3& a, const Vec3& b)
+    {
+      return a.X * b.X + a.Y * b.Y + a.Z * b.Z;
+    }
+
+    // -------------------------------------------------------------------------
+
+    uint64_t EdgeKey(uint32_t a, uint32_t b)
+    {
+      return (a < b) ? ((uint64_t)a << 32) | b
+                     : ((uint64_t)b << 32) | a;
+    }
+  }
+
+  // ===========================================================================
+
+  double ComputeACMR(const std::vector<uint32_t>& indices,
+                     size_t verticesCount,
+                     size_t cacheSize)
+  {
+    size_t trianglesCount = indices.size() / 3;
+
+    if (trianglesCount == 0)
+    {
+      return 0.0;
+    }
+
+    //
+    // Vertex is in cache if it was put there less than cacheSize misses
+    // ago, so there's no need to simulate the queue itself.
+    //
+    std::vector<int64_t> missNumber(verticesCount, -(int64_t)cacheSize - 1);
+
+    int64_t misses = 0;
+
+    for (size_t i = 0; i < trianglesCount * 3; i++)
+    {
+      uint32_t v = indices[i];
+
+      if (v >= verticesCount)
+      {
+        continue;
+      }
+
+      if (misses - missNumber[v] > (int64_t)cacheSize)
+      {
+        missNumber[v] = misses;
+        misses++;
+      }
+    }
+
+    return (double)misses / (double)trianglesCount;
+  }
+
+  // ===========================================================================
+
+  std::vector<uint32_t> OptimizeVertexCache(const std::vector<uint32_t>& indices,
+                                            size_t verticesCount,
+                                            size_t cacheSize)
+  {
+    static constexpr int64_t kNone = -1;
+
+    size_t trianglesCount = indices.size() / 3;
+
+    std::vector<uint32_t> order;
+
+    order.reserve(trianglesCount);
+
+    //
+    // Triangles of every vertex, vertex v has
+    // trianglesByVertex[firstTriangle[v], firstTriangle[v + 1]).
+    //
+    std::vector<uint32_t> firstTriangle(verticesCount + 1, 0);
+
+    for (size_t i = 0; i < trianglesCount * 3; i++)
+    {
+      firstTriangle[indices[i] + 1]++;
+    }
+
+    for (size_t v = 0; v < verticesCount; v++)
+    {
+      firstTriangle[v + 1] += firstTriangle[v];
+    }
+
+    std::vector<uint32_t> trianglesByVertex(trianglesCount * 3);
+
+    {
+      std::vector<uint32_t> filled(firstTriangle.begin(), firstTriangle.end() - 1);
+
+      for (size_t i = 0; i < trianglesCount * 3; i++)
+      {
+        trianglesByVertex[filled[indices[i]]++] = i / 3;
+      }
+    }
+
+    //
+    // Triangles not emitted yet.
+    //
+    std::vector<uint32_t> liveTriangles(verticesCount);
+
+    for (size_t v = 0; v < verticesCount; v++)
+    {
+      liveTriangles[v] = firstTriangle[v + 1] - firstTriangle[v];
+    }
+
+    //
+    // Vertex is in cache if it was put there less than cacheSize ticks ago.
+    //
+    std::vector<int64_t> cacheTime(verticesCount, 0);
+    std::vector<bool>    emitted(trianglesCount, false);
+
+    std::vector<uint32_t> deadEnd;
+    std::vector<uint32_t> candidates;
+
+    int64_t time   = cacheSize + 1;
+    size_t  cursor = 0;
+
+    int64_t fanning = kNone;
+
+    auto nextVertex = [&]() -> int64_t
+    {
+      int64_t best         = kNone;
+      int64_t bestPriority = 0;
+
+      for (uint32_t v : candidates)
+      {
+        if (liveTriangles[v] == 0)
+        {
+          continue;
+        }
+
+        //
+        // Oldest vertex that will still be in cache after all of its
+        // triangles are emitted. Ones that won't stay get zero and are
+        // never picked here, dead-end stack below takes care of them.
+        //
+        int64_t priority = 0;
+
+        if (time - cacheTime[v] + 2 * liveTriangles[v] <= (int64_t)cacheSize)
+        {
+          priority = time - cacheTime[v];
+        }
+
+        if (priority > bestPriority)
+        {
+          best         = v;
+          bestPriority = priority;
+        }
+      }
+
+      if (best != kNone)
+      {
+        return best;
+      }
+
+      //
+      // Dead end, try recently used vertices and then whatever is left.
+      //
+      while (not deadEnd.empty())
+      {
+        uint32_t v = deadEnd.back();
+
+        deadEnd.pop_back();
+
+        if (liveTriangles[v] != 0)
+        {
+          return v;
+        }
+      }
+
+      while (cursor < verticesCount)
+      {
+        if (liveTriangles[cursor] != 0)
+        {
+          return cursor;
+        }
+
+        cursor++;
+      }
+
+      return kNone;
+    };
+
+    fanning = nextVertex();
+
+    while (fanning != kNone)
+    {
+      candidates.clear();
+
+      for (uint32_t i = firstTriangle[fanning]; i < firstTriangle[fanning + 1]; i++)
+      {
+        uint32_t t = trianglesByVertex[i];
+
+        if (emitted[t])
+        {
+          continue;
+        }
+
+        emitted[t] = true;
+
+        order.push_back(t);
+
+        for (size_t j = 0; j < 3; j++)
+        {
+          uint32_t v = indices[t * 3 + j];
+
+          deadEnd.push_back(v);
+          candidates.push_back(v);
+
+          liveTriangles[v]--;
+
+          if (time - cacheTime[v] > (int64_t)cacheSize)
+          {
+            cacheTime[v] = time;
+            time++;
+          }
+        }
+      }
+
+      fanning = nextVertex();
+    }
+
+    return order;
+  }
+
+  // ===========================================================================
+
+  std::vector<uint32_t> ReorderTriangles(const std::vector<uint32_t>& indices,
+                                         const std::vector<uint32_t>& order)
+  {
+    std::vector<uint32_t> res;
+
+    res.reserve(order.size() * 3);
+
+    for (uint32_t t : order)
+    {
+      res.push_back(indices[t * 3 + 0]);
+      res.push_back(indices[t * 3 + 1]);
+      res.push_back(indices[t * 3 + 2]);
+    }
+
+    return res;
+  }
+
+  // ===========================================================================
+
+  void OptimizeVertexFetch(std::vector<Vertex>& vertices,
+                           std::vector<uint32_t>& indices)
+  {
+    static constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+
+    std::vector<uint32_t> remap(vertices.size(), kNone);
+    std::vector<Vertex>   res;
+
+    res.reserve(vertices.size());
+
+    for (uint32_t& index : indices)
+    {
+      if (remap[index] == kNone)
+      {
+        remap[index] = res.size();
+        res.push_back(vertices[index]);
+      }
+
+      index = remap[index];
+    }
+
+    vertices.swap(res);
+  }
+
+  // ===========================================================================
+
+  std::vector<uint32_t> SimplifyMesh(const std::vector<Vertex>& vertices,
+                                     const std::vector<uint32_t>& indices,
+                                     size_t targetTrianglesCount)
+  {
+    static constexpr size_t kMaxPasses = 64;
+
+    const size_t verticesCount = vertices.size();
+
+    std::vector<uint32_t> res(indices.begin(),
+                              indices.begin() + (indices.size() / 3) * 3);
+
+    if (res.size() / 3 <= targetTrianglesCount)
+    {
+      return res;
+    }
+
+    auto position = [&vertices](uint32_t v) -> const Vec3&
+    {
+      return vertices[v].Position;
+    };
+
+    //
+    // Vertices with the same position but different normals or UV are one
+    // point as far as simplification goes. Point is known by its first
+    // vertex.
+    //
+    std::vector<uint32_t> point(verticesCount);
+
+    {
+      std::vector<uint32_t> order(verticesCount);
+
+      std::iota(order.begin(), order.end(), 0);
+
+      std::sort(order.begin(), order.end(),
+      [&position](uint32_t a, uint32_t b)
+      {
+        const Vec3& pa = position(a);
+        const Vec3& pb = position(b);
+
+        if (pa.X != pb.X) return pa.X < pb.X;
+        if (pa.Y != pb.Y) return pa.Y < pb.Y;
+        if (pa.Z != pb.Z) return pa.Z < pb.Z;
+
+        return a < b;
+      });
+
+      for (size_t i = 0; i < verticesCount; i++)
+      {
+        bool same = false;
+
+        if (i != 0)
+        {
+          const Vec3& p = position(order[i]);
+          const Vec3& q = position(order[i - 1]);
+
+          same = (p.X == q.X and p.Y == q.Y and p.Z == q.Z);
+        }
+
+        point[order[i]] = same ? point[order[i - 1]] : order[i];
+      }
+    }
+
+    //
+    // Every point starts with planes of its triangles, weighted by area so
+    // that tiny triangles don't matter much.
+    //
+    std::vector<Quadric> quadrics(verticesCount);
+
+    for (size_t t = 0; t < res.size() / 3; t++)
+    {
+      uint32_t a = point[res[t * 3 + 0]];
+      uint32_t b = point[res[t * 3 + 1]];
+      uint32_t c = point[res[t * 3 + 2]];
+
+      Vec3 n = TriangleNormal(position(a), position(b), position(c));
+
+      double l = n.Length();
+
+      if (l == 0.0)
+      {
+        continue;
+      }
+
+      n = n * (1.0 / l);
+
+      double d = -Dot(n, position(a));
+
+      for (uint32_t p : { a, b, c })
+      {
+        quadrics[p].AddPlane(n, d, l * 0.5);
+      }
+    }
+
+    //
+    // Edges that don't have exactly two triangles are on the border (or
+    // worse), and their points stay where they are.
+    //
+    std::vector<bool> locked(verticesCount, false);
+
+    std::vector<uint64_t> edges;
+
+    auto collectEdges = [&res, &point, &edges]()
+    {
+      edges.clear();
+      edges.reserve(res.size());
+
+      for (size_t t = 0; t < res.size() / 3; t++)
+      {
+        for (size_t i = 0; i < 3; i++)
+        {
+          uint32_t a = point[res[t * 3 + i]];
+          uint32_t b = point[res[t * 3 + (i + 1) % 3]];
+
+          edges.push_back(EdgeKey(a, b));
+        }
+      }
+
+      std::sort(edges.begin(), edges.end());
+    };
+
+    collectEdges();
+
+    for (size_t i = 0; i < edges.size(); )
+    {
+      size_t j = i;
+
+      while (j < edges.size() and edges[j] == edges[i])
+      {
+        j++;
+      }
+
+      if (j - i != 2)
+      {
+        locked[edges[i] >> 32]          = true;
+        locked[edges[i] & 0xFFFFFFFFu] = true;
+      }
+
+      i = j;
+    }
+
+    struct Collapse
+    {
+      uint32_t From;
+      uint32_t To;
+      double   Cost;
+    };
+
+    std::vector<Collapse> collapses;
+
+    std::vector<uint32_t> remap(verticesCount);
+    std::vector<bool>     touched(verticesCount);
+
+    std::vector<uint32_t> firstTriangle(verticesCount + 1);
+    std::vector<uint32_t> trianglesByPoint;
+
+    std::iota(remap.begin(), remap.end(), 0);
+
+    for (size_t pass = 0; pass < kMaxPasses; pass++)
+    {
+      size_t trianglesCount = res.size() / 3;
+
+      if (trianglesCount <= targetTrianglesCount)
+      {
+        break;
+      }
+
+      //
+      // Triangles of every point.
+      //
+      std::fill(firstTriangle.begin(), firstTriangle.end(), 0);
+
+      for (uint32_t v : res)
+      {
+        firstTriangle[point[v] + 1]++;
+      }
+
+      for (size_t p = 0; p < verticesCount; p++)
+      {
+        firstTriangle[p + 1] += firstTriangle[p];
+      }
+
+      trianglesByPoint.resize(res.size());
+
+      {
+        std::vector<uint32_t> filled(firstTriangle.begin(),
+                                     firstTriangle.end() - 1);
+
+        for (size_t i = 0; i < res.size(); i++)
+        {
+          trianglesByPoint[filled[point[res[i]]]++] = i / 3;
+        }
+      }
+
+      //
+      // Cheapest way to collapse every edge.
+      //
+      if (pass != 0)
+      {
+        collectEdges();
+      }
+
+      edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+      collapses.clear();
+
+      for (uint64_t e : edges)
+      {
+        uint32_t a = e >> 32;
+        uint32_t b = e & 0xFFFFFFFFu;
+
+        if (locked[a] and locked[b])
+        {
+          continue;
+        }
+
+        Quadric q = quadrics[a];
+
+        q.Add(quadrics[b]);
+
+        double costAB = locked[a] ? std::numeric_limits<double>::max()
+                                  : q.Error(position(b));
+
+        double costBA = locked[b] ? std::numeric_limits<double>::max()
+                                  : q.Error(position(a));
+
+        if (costAB <= costBA)
+        {
+          collapses.push_back({ a, b, costAB });
+        }
+        else
+        {
+          collapses.push_back({ b, a, costBA });
+        }
+      }
+
+      std::sort(collapses.begin(), collapses.end(),
+      [](const Collapse& l, const Collapse& r)
+      {
+        return l.Cost < r.Cost;
+      });
+
+      //
+      // Points are collapsed at most once per pass and never onto a point
+      // that has already moved, so remap is never more than one step deep.
+      //
+      std::fill(touched.begin(), touched.end(), false);
+
+      size_t toRemove = trianglesCount - targetTrianglesCount;
+      size_t removed  = 0;
+
+      for (const Collapse& c : collapses)
+      {
+        if (removed >= toRemove)
+        {
+          break;
+        }
+
+        if (touched[c.From] or touched[c.To])
+        {
+          continue;
+        }
+
+        //
+        // Triangles around the point that stay must not flip over.
+        //
+        bool ok = true;
+
+        size_t degenerate = 0;
+
+        for (uint32_t i = firstTriangle[c.From]; i < firstTriangle[c.From + 1]; i++)
+        {
+          uint32_t t = trianglesByPoint[i];
+
+          uint32_t p[3] =
+          {
+            remap[point[res[t * 3 + 0]]],
+            remap[point[res[t * 3 + 1]]],
+            remap[point[res[t * 3 + 2]]]
+          };
+
+          if (p[0] == p[1] or p[1] == p[2] or p[0] == p[2])
+          {
+            continue;
+          }
+
+          if (p[0] == c.To or p[1] == c.To or p[2] == c.To)
+          {
+            degenerate++;
+            continue;
+          }
+
+          Vec3 before = TriangleNormal(position(p[0]), position(p[1]), position(p[2]));
+
+          for (uint32_t& q : p)
+          {
+            if (q == c.From)
+            {
+              q = c.To;
+            }
+          }
+
+          Vec3 after = TriangleNormal(position(p[0]), position(p[1]), position(p[2]));
+
+          if (Dot(before, after) <= 0.0)
+          {
+            ok = false;
+            break;
+          }
+        }
+
+        if (not ok)
+        {
+          continue;
+        }
+
+        remap[c.From] = c.To;
+
+        touched[c.From] = true;
+        touched[c.To]   = true;
+
+        quadrics[c.To].Add(quadrics[c.From]);
+
+        removed += degenerate;
+      }
+
+      if (removed == 0)
+      {
+        break;
+      }
+
+      //
+      // Moved corners take the first vertex of the point they moved to,
+      // the rest keep their own normals and UV.
+      //
+      size_t kept = 0;
+
+      for (size_t t = 0; t < trianglesCount; t++)
+      {
+        uint32_t v[3];
+
+        for (size_t i = 0; i < 3; i++)
+        {
+          v[i] = res[t * 3 + i];
+
+          uint32_t p = point[v[i]];
+
+          if (remap[p] != p)
+          {
+            v[i] = remap[p];
+          }
+        }
+
+        if (point[v[0]] == point[v[1]]
+         or point[v[1]] == point[v[2]]
+         or point[v[0]] == point[v[2]])
+        {
+          continue;
+        }
+
+        res[kept * 3 + 0] = v[0];
+        res[kept * 3 + 1] = v[1];
+        res[kept * 3 + 2] = v[2];
+
+        kept++;
+      }
+
+      res.resize(kept * 3);
+
+      std::iota(remap.begin(), remap.end(), 0);
+    }
+
+    return res;
+  }
+}
@@ -0,0 +1,56 @@
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include <vector>
+
+#include "types.h"
+
+namespace SW3D
+{
+  //
+  // Average cache miss ratio: how many vertices per triangle have to be
+  // transformed with FIFO cache of given size in front of transform.
+  // Three is the worst, around 0.5 is the best for big regular meshes.
+  //
+  double ComputeACMR(const std::vector<uint32_t>& indices,
+                     size_t verticesCount,
+                     size_t cacheSize = Constants::kVertexCacheSize);
+
+  //
+  // Order of triangles (new position -> old triangle number) that reuses
+  // recently transformed vertices as much as possible (Tipsify, see
+  // "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw"
+  // by Sander, Nehab and Barczak). Linear time.
+  //
+  std::vector<uint32_t> OptimizeVertexCache(const std::vector<uint32_t>& indices,
+                                            size_t verticesCount,
+                                            size_t cacheSize = Constants::kVertexCacheSize);
+
+  //
+  // Triangles of indices in given order.
+  //
+  std::vector<uint32_t> ReorderTriangles(const std::vector<uint32_t>& indices,
+                                         const std::vector<uint32_t>& order);
+
+  //
+  // Renumbers vertices in order of first use by indices, so that they're
+  // fetched mostly sequentially. Vertices not used by any triangle are
+  // dropped.
+  //
+  void OptimizeVertexFetch(std::vector<Vertex>& vertices,
+                           std::vector<uint32_t>& indices);
+
+  //
+  // Simplified version of indices with about targetTrianglesCount triangles
+  // (or more, if it can't be simplified that much) over the same vertices.
+  // Edges are collapsed in order of quadric error ("Surface Simplification
+  // Using Quadric Error Metrics" by Garland and Heckbert), one end moving
+  // to the other, so no new vertices are needed. Vertices on mesh borders
+  // never move.
+  //
+  std::vector<uint32_t> SimplifyMesh(const std::vector<Vertex>& vertices,
+                                     const std::vector<uint32_t>& indices,
+                                     size_t targetTrianglesCount);
+}
+
+#endif // MESHOPTIMIZER_H
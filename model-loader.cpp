@@ -1,211 +1,1290 @@
 #include "model-loader.h"
+#include "mesh-optimizer.h"
 
 #include <fstream>
-#include <memory>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <thread>
+#include <filesystem>
+#include <type_traits>
+#include <limits>
 
 namespace SW3D
 {
+  namespace
+  {
+    bool IsBlank(char c)
+    {
+      return (c == ' ' or c == '\t' or c == '\r');
+    }
+
+    // -------------------------------------------------------------------------
+
+    const char* SkipBlanks(const char* p, const char* end)
+    {
+      while (p != end and IsBlank(*p))
+      {
+        p++;
+      }
+
+      return p;
+    }
+
+    // -------------------------------------------------------------------------
+
+    //
+    // Calls fn(begin, end) for every non-empty line with comments and
+    // surrounding whitespace cut off, stops if fn returns false.
+    //
+    template <typename Fn>
+    bool ForEachLine(const char* begin, const char* end, const Fn& fn)
+    {
+      const char* p = begin;
+
+      while (p != end)
+      {
+        const char* eol = (const char*)std::memchr(p, '\n', end - p);
+        const char* next = (eol != nullptr) ? eol + 1 : end;
+
+        if (eol == nullptr)
+        {
+          eol = end;
+        }
+
+        const char* comment = (const char*)std::memchr(p, '#', eol - p);
+        if (comment != nullptr)
+        {
+          eol = comment;
+        }
+
+        p = SkipBlanks(p, eol);
+
+        while (eol != p and IsBlank(*(eol - 1)))
+        {
+          eol--;
+        }
+
+        if (p != eol and not fn(p, eol))
+        {
+          return false;
+        }
+
+        p = next;
+      }
+
+      return true;
+    }
+
+    // -------------------------------------------------------------------------
+
+    bool ParseDouble(const char*& p, const char* end, double& res)
+    {
+      p = SkipBlanks(p, end);
+
+      //
+      // from_chars() doesn't take explicit plus sign.
+      //
+      if (p != end and *p == '+')
+      {
+        p++;
+      }
+
+      auto [ptr, ec] = std::from_chars(p, end, res);
+
+      if (ec != std::errc())
+      {
+        return false;
+      }
+
+      p = ptr;
+
+      return true;
+    }
+
+    // -------------------------------------------------------------------------
+
+    bool ParseVec3(const char*& p, const char* end, Vec3& res)
+    {
+      return (ParseDouble(p, end, res.X)
+          and ParseDouble(p, end, res.Y)
+          and ParseDouble(p, end, res.Z));
+    }
+
+    // -------------------------------------------------------------------------
+
+    bool ParseInt(const char*& p, const char* end, int32_t& res)
+    {
+      if (p != end and *p == '+')
+      {
+        p++;
+      }
+
+      auto [ptr, ec] = std::from_chars(p, end, res);
+
+      if (ec != std::errc())
+      {
+        return false;
+      }
+
+      p = ptr;
+
+      return true;
+    }
+
+    // -------------------------------------------------------------------------
+
+    //
+    // One of v, v/t, v//n or v/t/n.
+    //
+    bool ParseFaceVertex(const char*& p, const char* end, int32_t (&indices)[3])
+    {
+      p = SkipBlanks(p, end);
+
+      for (size_t j = 0; j < 3; j++)
+      {
+        if (j != 0)
+        {
+          if (p == end or *p != '/')
+          {
+            break;
+          }
+
+          p++;
+
+          //
+          // Empty means not defined, e.g. no texture coordinates.
+          //
+          if (p == end or *p == '/' or IsBlank(*p))
+          {
+            continue;
+          }
+        }
+
+        int32_t value = 0;
+
+        if (not ParseInt(p, end, value))
+        {
+          return false;
+        }
+
+        //
+        // Indices are 1 based.
+        //
+        indices[j] = value - 1;
+      }
+
+      return (p == end or IsBlank(*p));
+    }
+
+    // -------------------------------------------------------------------------
+
+    template <typename T>
+    bool IsValidIndex(int32_t ind, const std::vector<T>& v)
+    {
+      return (ind >= 0 and (size_t)ind < v.size());
+    }
+
+    // -------------------------------------------------------------------------
+
+    //
+    // FNV-1a.
+    //
+    uint64_t Hash(const char* data, size_t size)
+    {
+      uint64_t res = 14695981039346656037ull;
+
+      for (size_t i = 0; i < size; i++)
+      {
+        res ^= (uint8_t)data[i];
+        res *= 1099511628211ull;
+      }
+
+      return res;
+    }
+
+    // -------------------------------------------------------------------------
+
+    bool GetSourceInfo(const std::string& fname, uint64_t& size, int64_t& time)
+    {
+      std::error_code ec;
+
+      size = std::filesystem::file_size(fname, ec);
+
+      if (ec)
+      {
+        return false;
+      }
+
+      time = std::filesystem::last_write_time(fname, ec).time_since_epoch().count();
+
+      return (not ec);
+    }
+
+    // -------------------------------------------------------------------------
+
+    std::string CacheFname(const std::string& fname)
+    {
+      return fname + ".sw3dmesh";
+    }
+
+    // -------------------------------------------------------------------------
+
+    template <typename T>
+    bool ReadArray(std::istream& f, std::vector<T>& v, size_t count)
+    {
+      static_assert(std::is_trivially_copyable<T>::value,
+                    "cached arrays are read as is");
+
+      v.resize(count);
+
+      return (count == 0
+           or f.read((char*)v.data(), count * sizeof(T)));
+    }
+
+    // -------------------------------------------------------------------------
+
+    template <typename T>
+    void WriteArray(std::ostream& f, const std::vector<T>& v)
+    {
+      static_assert(std::is_trivially_copyable<T>::value,
+                    "cached arrays are written as is");
+
+      f.write((const char*)v.data(), v.size() * sizeof(T));
+    }
+
+    // -------------------------------------------------------------------------
+
+    //
+    // Calls fn(0) .. fn(count - 1) each on its own thread, calling one
+    // included, and returns when all of them are done.
+    //
+    template <typename Fn>
+    void RunParallel(size_t count, const Fn& fn)
+    {
+      std::vector<std::thread> threads;
+
+      if (count > 1)
+      {
+        threads.reserve(count - 1);
+      }
+
+      for (size_t i = 1; i < count; i++)
+      {
+        threads.emplace_back([&fn, i]() { fn(i); });
+      }
+
+      if (count != 0)
+      {
+        fn(0);
+      }
+
+      for (std::thread& t : threads)
+      {
+        t.join();
+      }
+    }
+  }
+
+  // ===========================================================================
+
   void ModelLoader::ToTriangles(Scene::Object& obj)
   {
     obj.Triangles.clear();
+    obj.Triangles.reserve(obj.Faces.size());
+
+    for (auto& face : obj.Faces)
+    {
+      Triangle t;
+      for (size_t i = 0; i < 3; i++)
+      {
+        int32_t vertexInd  = face.Indices[i][0];
+        int32_t textureInd = face.Indices[i][1];
+        int32_t normalInd  = face.Indices[i][2];
+
+        if (IsValidIndex(vertexInd, _scene.Vertices))
+        {
+          t.Points[i].Position = _scene.Vertices[vertexInd];
+        }
+
+        if (IsValidIndex(textureInd, _scene.UV))
+        {
+          t.Points[i].UV = _scene.UV[textureInd];
+        }
+
+        if (IsValidIndex(normalInd, _scene.Normals))
+        {
+          t.Points[i].Normal = _scene.Normals[normalInd];
+        }
+      }
+
+      obj.Triangles.push_back(t);
+    }
+  }
+
+  // ===========================================================================
+
+  void ModelLoader::ToIndexed(Scene::Object& obj)
+  {
+    static constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+
+    obj.VertexBuffer.clear();
+    obj.IndexBuffer.clear();
+
+    obj.IndexBuffer.reserve(obj.Faces.size() * 3);
+
+    //
+    // Vertices that share position are chained together, so finding
+    // the same combination is a walk over a couple of them at most
+    // instead of hashing.
+    //
+    std::vector<uint32_t> nextWithPosition;
+
+    _firstByPosition.resize(_scene.Vertices.size(), kNone);
+
+    struct Key
+    {
+      int32_t Position;
+      int32_t Texture;
+      int32_t Normal;
+    };
+
+    std::vector<Key> keys;
+
+    for (auto& face : obj.Faces)
+    {
+      if (not IsValidIndex(face.Indices[0][0], _scene.Vertices)
+       or not IsValidIndex(face.Indices[1][0], _scene.Vertices)
+       or not IsValidIndex(face.Indices[2][0], _scene.Vertices))
+      {
+        continue;
+      }
+
+      for (size_t i = 0; i < 3; i++)
+      {
+        int32_t vertexInd  = face.Indices[i][0];
+        int32_t textureInd = face.Indices[i][1];
+        int32_t normalInd  = face.Indices[i][2];
+
+        if (not IsValidIndex(textureInd, _scene.UV))
+        {
+          textureInd = -1;
+        }
+
+        if (not IsValidIndex(normalInd, _scene.Normals))
+        {
+          normalInd = -1;
+        }
+
+        uint32_t index = _firstByPosition[vertexInd];
+
+        while (index != kNone
+           and (keys[index].Texture != textureInd
+             or keys[index].Normal  != normalInd))
+        {
+          index = nextWithPosition[index];
+        }
+
+        if (index == kNone)
+        {
+          index = obj.VertexBuffer.size();
+
+          Vertex v;
+
+          v.Position = _scene.Vertices[vertexInd];
+
+          if (textureInd != -1)
+          {
+            v.UV = _scene.UV[textureInd];
+          }
+
+          if (normalInd != -1)
+          {
+            v.Normal = _scene.Normals[normalInd];
+          }
+
+          obj.VertexBuffer.push_back(v);
+
+          keys.push_back({ vertexInd, textureInd, normalInd });
+
+          nextWithPosition.push_back(_firstByPosition[vertexInd]);
+          _firstByPosition[vertexInd] = index;
+        }
+
+        obj.IndexBuffer.push_back(index);
+      }
+    }
+
+    obj.VertexBuffer.shrink_to_fit();
+
+    //
+    // Only touched ones are reset, so that it's cheap for the next object.
+    //
+    for (const Key& key : keys)
+    {
+      _firstByPosition[key.Position] = kNone;
+    }
+  }
+
+  // ===========================================================================
+
+  void ModelLoader::OptimizeFaces(Scene::Object& obj)
+  {
+    ToIndexed(obj);
+
+    obj.ACMRBefore = ComputeACMR(obj.IndexBuffer, obj.VertexBuffer.size());
+
+    std::vector<uint32_t> order = OptimizeVertexCache(obj.IndexBuffer,
+                                                      obj.VertexBuffer.size());
+
+    obj.IndexBuffer = ReorderTriangles(obj.IndexBuffer, order);
+
+    obj.ACMRAfter = ComputeACMR(obj.IndexBuffer, obj.VertexBuffer.size());
+
+    OptimizeVertexFetch(obj.VertexBuffer, obj.IndexBuffer);
+
+    //
+    // Triangles of index buffer are faces that have all of their vertices,
+    // in the same order. Faces that don't go last.
+    //
+    using Face = Scene::Object::Face;
+
+    std::vector<Face> valid;
+    std::vector<Face> invalid;
+
+    valid.reserve(order.size());
+
+    for (const Face& face : obj.Faces)
+    {
+      if (IsValidIndex(face.Indices[0][0], _scene.Vertices)
+      and IsValidIndex(face.Indices[1][0], _scene.Vertices)
+      and IsValidIndex(face.Indices[2][0], _scene.Vertices))
+      {
+        valid.push_back(face);
+      }
+      else
+      {
+        invalid.push_back(face);
+      }
+    }
+
+    obj.Faces.clear();
+
+    for (uint32_t t : order)
+    {
+      obj.Faces.push_back(valid[t]);
+    }
+
+    obj.Faces.insert(obj.Faces.end(), invalid.begin(), invalid.end());
+  }
+
+  // ===========================================================================
+
+  void ModelLoader::BuildLods(Scene::Object& obj)
+  {
+    obj.Lods.clear();
+
+    size_t levels = GetLodLevelsToBuild();
+
+    for (size_t i = 0; i < levels; i++)
+    {
+      const std::vector<uint32_t>& prev = (i == 0) ? obj.IndexBuffer
+                                                   : obj.Lods.back();
+
+      size_t prevCount = prev.size() / 3;
+      size_t target    = prevCount / 4;
+
+      if (target < kMinLodTriangles)
+      {
+        break;
+      }
+
+      std::vector<uint32_t> lod = SimplifyMesh(obj.VertexBuffer, prev, target);
+
+      //
+      // Not worth it if it didn't get much simpler.
+      //
+      if (lod.size() / 3 > prevCount * 3 / 4)
+      {
+        break;
+      }
+
+      if (_optimizeVertexCache)
+      {
+        lod = ReorderTriangles(lod, OptimizeVertexCache(lod, obj.VertexBuffer.size()));
+      }
+
+      obj.Lods.push_back(std::move(lod));
+    }
+  }
+
+  // ===========================================================================
+
+  size_t ModelLoader::GetLodLevelsToBuild() const
+  {
+    return (_meshOutput == MeshOutput::TRIANGLES) ? 0 : _lodLevels;
+  }
+
+  // ===========================================================================
+
+  void ModelLoader::BuildMeshes(Scene::Object& obj, bool optimize)
+  {
+    //
+    // Index buffer made from reordered faces is the same as the one
+    // OptimizeFaces() leaves, so it's not built again.
+    //
+    if (optimize)
+    {
+      OptimizeFaces(obj);
+    }
+    else if (_meshOutput != MeshOutput::TRIANGLES)
+    {
+      ToIndexed(obj);
+    }
+
+    if (_meshOutput == MeshOutput::TRIANGLES)
+    {
+      obj.VertexBuffer = std::vector<Vertex>();
+      obj.IndexBuffer  = std::vector<uint32_t>();
+    }
+
+    if (_meshOutput != MeshOutput::INDEXED)
+    {
+      ToTriangles(obj);
+    }
+  }
+
+  // ===========================================================================
+
+  void ModelLoader::ComputeBounds(Scene::Object& obj)
+  {
+    obj.Bounds = AABB();
+    obj.Sphere = BoundingSphere();
+
+    auto forEachVertex = [this, &obj](const auto& fn)
+    {
+      for (auto& face : obj.Faces)
+      {
+        for (size_t i = 0; i < 3; i++)
+        {
+          int32_t vertexInd = face.Indices[i][0];
+
+          if (IsValidIndex(vertexInd, _scene.Vertices))
+          {
+            fn(_scene.Vertices[vertexInd]);
+          }
+        }
+      }
+    };
+
+    forEachVertex([&obj](const Vec3& v) { obj.Bounds.Add(v); });
+
+    if (obj.Bounds.IsEmpty())
+    {
+      return;
+    }
+
+    //
+    // Not the smallest sphere possible, but centered at the box it's
+    // usually close enough and is much tighter than box's circumsphere.
+    //
+    obj.Sphere.Center = (obj.Bounds.Min + obj.Bounds.Max) * 0.5;
+    obj.Sphere.Radius = 0.0;
+
+    forEachVertex([&obj](const Vec3& v)
+    {
+      Vec3 d = v - obj.Sphere.Center;
+      obj.Sphere.Radius = std::max(obj.Sphere.Radius, d.Length());
+    });
+  }
+
+  // ===========================================================================
+
+  ModelLoader::ObjFileLineType ModelLoader::GetLineType(const char*& p,
+                                                        const char* end)
+  {
+    const char* word = p;
+
+    while (p != end and not IsBlank(*p))
+    {
+      p++;
+    }
+
+    size_t len = p - word;
+
+    if (len == 1)
+    {
+      switch (word[0])
+      {
+        case 'o': return ObjFileLineType::OBJECT;
+        case 'v': return ObjFileLineType::VERTEX;
+        case 's': return ObjFileLineType::SHADING;
+        case 'f': return ObjFileLineType::FACE;
+        default:  break;
+      }
+    }
+    else if (len == 2 and word[0] == 'v')
+    {
+      switch (word[1])
+      {
+        case 'n': return ObjFileLineType::VERTEX_NORMAL;
+        case 't': return ObjFileLineType::VERTEX_TEXTURE;
+        default:  break;
+      }
+    }
+
+    return ObjFileLineType::UNDEFINED;
+  }
+
+  // ===========================================================================
+
+  bool ModelLoader::LoadCache(const std::string& fname)
+  {
+    using Face = Scene::Object::Face;
+
+    uint64_t sourceSize = 0;
+    int64_t  sourceTime = 0;
+
+    if (not GetSourceInfo(fname, sourceSize, sourceTime))
+    {
+      return false;
+    }
+
+    std::ifstream f(CacheFname(fname), std::ios::binary | std::ios::ate);
+
+    if (not f.is_open())
+    {
+      return false;
+    }
+
+    uint64_t cacheSize = f.tellg();
+
+    f.seekg(0);
+
+    CacheHeader h;
+
+    if (not f.read((char*)&h, sizeof(h))
+     or std::memcmp(h.Magic, kCacheMagic, sizeof(kCacheMagic)) != 0
+     or h.Version    != kCacheVersion
+     or h.Optimized  != (uint64_t)_optimizeVertexCache
+     or h.LodLevels  != (uint64_t)GetLodLevelsToBuild()
+     or h.SourceSize != sourceSize)
+    {
+      return false;
+    }
+
+    //
+    // File was touched but not changed, cache is still good.
+    //
+    bool touched = (h.SourceTime != sourceTime);
+
+    if (touched)
+    {
+      std::vector<char> source;
+
+      if (not ReadFile(fname, source)
+       or Hash(source.data(), source.size()) != h.SourceHash)
+      {
+        return false;
+      }
+    }
+
+    //
+    // Counts are checked against actual size before anything is allocated,
+    // so that damaged file can't make us allocate a lot.
+    //
+    uint64_t expectedSize = sizeof(CacheHeader)
+                          + h.ObjectsCount  * sizeof(CacheObject)
+                          + h.LodsCount     * sizeof(uint64_t)
+                          + h.NamesSize
+                          + h.VerticesCount * sizeof(Vec3)
+                          + h.NormalsCount  * sizeof(Vec3)
+                          + h.UVCount       * sizeof(Vec2)
+                          + h.FacesCount    * sizeof(Face)
+                          + h.LodIndicesCount * sizeof(uint32_t);
+
+    if (expectedSize != cacheSize)
+    {
+      return false;
+    }
+
+    std::vector<CacheObject> objects;
+    std::vector<uint64_t>    lodSizes;
+    std::vector<char>        names;
+
+    if (not ReadArray(f, objects, h.ObjectsCount)
+     or not ReadArray(f, lodSizes, h.LodsCount)
+     or not ReadArray(f, names, h.NamesSize)
+     or not ReadArray(f, _scene.Vertices, h.VerticesCount)
+     or not ReadArray(f, _scene.Normals, h.NormalsCount)
+     or not ReadArray(f, _scene.UV, h.UVCount))
+    {
+      _scene = Scene();
+      return false;
+    }
+
+    _scene.Objects.resize(objects.size());
+
+    uint64_t facesLeft = h.FacesCount;
+    uint64_t namesLeft = h.NamesSize;
+
+    const char* name = names.data();
+
+    for (size_t i = 0; i < objects.size(); i++)
+    {
+      const CacheObject& co = objects[i];
+      Scene::Object& obj    = _scene.Objects[i];
+
+      if (co.FacesCount > facesLeft
+       or co.NameLength > namesLeft
+       or not ReadArray(f, obj.Faces, co.FacesCount))
+      {
+        _scene = Scene();
+        return false;
+      }
+
+      facesLeft -= co.FacesCount;
+      namesLeft -= co.NameLength;
 
-    for (auto& face : obj.Faces)
+      obj.Name.assign(name, co.NameLength);
+
+      name += co.NameLength;
+
+      obj.Bounds.Min = { co.BoundsMin[0], co.BoundsMin[1], co.BoundsMin[2] };
+      obj.Bounds.Max = { co.BoundsMax[0], co.BoundsMax[1], co.BoundsMax[2] };
+
+      obj.Sphere.Center = { co.SphereCenter[0],
+                            co.SphereCenter[1],
+                            co.SphereCenter[2] };
+
+      obj.Sphere.Radius = co.SphereRadius;
+
+      obj.ACMRBefore = co.ACMRBefore;
+      obj.ACMRAfter  = co.ACMRAfter;
+
+      BuildMeshes(obj, false);
+    }
+
+    uint64_t lodsLeft    = h.LodsCount;
+    uint64_t indicesLeft = h.LodIndicesCount;
+
+    const uint64_t* lodSize = lodSizes.data();
+
+    for (size_t i = 0; i < objects.size(); i++)
     {
-      Triangle t;
-      for (size_t i = 0; i < 3; i++)
+      Scene::Object& obj = _scene.Objects[i];
+
+      if (objects[i].LodsCount > lodsLeft)
       {
-        int32_t vertexInd  = face.Indices[i][0];
-        int32_t textureInd = face.Indices[i][1];
-        int32_t normalInd  = face.Indices[i][2];
+        _scene = Scene();
+        return false;
+      }
 
-        if (vertexInd != -1)
-        {
-          t.Points[i].Position = _scene.Vertices[vertexInd];
-        }
+      lodsLeft -= objects[i].LodsCount;
 
-        if (textureInd != -1)
-        {
-          t.Points[i].UV = _scene.UV[textureInd];
-        }
+      obj.Lods.resize(objects[i].LodsCount);
 
-        if (normalInd != -1)
+      for (std::vector<uint32_t>& lod : obj.Lods)
+      {
+        uint64_t size = *lodSize++;
+
+        //
+        // Indices are only checked against vertex buffer once, here.
+        //
+        if (size > indicesLeft
+         or not ReadArray(f, lod, size)
+         or std::any_of(lod.begin(), lod.end(), [&obj](uint32_t index)
+            {
+              return index >= obj.VertexBuffer.size();
+            }))
         {
-          t.Points[i].Normal = _scene.Normals[normalInd];
+          _scene = Scene();
+          return false;
         }
+
+        indicesLeft -= size;
       }
+    }
 
-      obj.Triangles.push_back(t);
+    //
+    // So that it's not hashed again every time.
+    //
+    if (touched)
+    {
+      f.close();
+
+      std::fstream out(CacheFname(fname),
+                       std::ios::binary | std::ios::in | std::ios::out);
+
+      h.SourceTime = sourceTime;
+
+      out.write((const char*)&h, sizeof(h));
     }
+
+    return true;
   }
 
   // ===========================================================================
 
-  StringV ModelLoader::StringSplit(const std::string& str, char delim)
+  void ModelLoader::SaveCache(const std::string& fname,
+                              const std::vector<char>& source)
   {
-    StringV res;
+    CacheHeader h;
+
+    std::memcpy(h.Magic, kCacheMagic, sizeof(kCacheMagic));
+
+    h.Version   = kCacheVersion;
+    h.Optimized = _optimizeVertexCache;
+    h.LodLevels = GetLodLevelsToBuild();
+
+    if (not GetSourceInfo(fname, h.SourceSize, h.SourceTime)
+     or h.SourceSize != source.size())
+    {
+      return;
+    }
+
+    h.SourceHash = Hash(source.data(), source.size());
+
+    h.VerticesCount = _scene.Vertices.size();
+    h.NormalsCount  = _scene.Normals.size();
+    h.UVCount       = _scene.UV.size();
+    h.ObjectsCount  = _scene.Objects.size();
+    h.FacesCount    = 0;
+    h.NamesSize     = 0;
+
+    h.LodsCount       = 0;
+    h.LodIndicesCount = 0;
+
+    std::vector<CacheObject> objects;
+    std::vector<uint64_t>    lodSizes;
 
-    int start, end = -1;
+    objects.reserve(_scene.Objects.size());
 
-    do
+    for (const Scene::Object& obj : _scene.Objects)
     {
-      start = end + 1;
-      end = str.find(delim, start);
-      if (end != -1)
+      CacheObject co;
+
+      co.FacesCount = obj.Faces.size();
+      co.NameLength = obj.Name.length();
+
+      const AABB& b = obj.Bounds;
+      const BoundingSphere& s = obj.Sphere;
+
+      co.BoundsMin[0] = b.Min.X;
+      co.BoundsMin[1] = b.Min.Y;
+      co.BoundsMin[2] = b.Min.Z;
+
+      co.BoundsMax[0] = b.Max.X;
+      co.BoundsMax[1] = b.Max.Y;
+      co.BoundsMax[2] = b.Max.Z;
+
+      co.SphereCenter[0] = s.Center.X;
+      co.SphereCenter[1] = s.Center.Y;
+      co.SphereCenter[2] = s.Center.Z;
+
+      co.SphereRadius = s.Radius;
+
+      co.ACMRBefore = obj.ACMRBefore;
+      co.ACMRAfter  = obj.ACMRAfter;
+
+      co.LodsCount = obj.Lods.size();
+
+      for (const std::vector<uint32_t>& lod : obj.Lods)
       {
-        std::string word = str.substr(start, end - start);
-        res.push_back(word);
+        lodSizes.push_back(lod.size());
+
+        h.LodIndicesCount += lod.size();
       }
-      else
+
+      h.FacesCount += co.FacesCount;
+      h.NamesSize  += co.NameLength;
+      h.LodsCount  += co.LodsCount;
+
+      objects.push_back(co);
+    }
+
+    //
+    // Failing to write it is not an error, model is just parsed again
+    // next time, and half written file won't pass size check.
+    //
+    std::ofstream f(CacheFname(fname), std::ios::binary | std::ios::trunc);
+
+    if (not f.is_open())
+    {
+      return;
+    }
+
+    f.write((const char*)&h, sizeof(h));
+
+    WriteArray(f, objects);
+    WriteArray(f, lodSizes);
+
+    for (const Scene::Object& obj : _scene.Objects)
+    {
+      f.write(obj.Name.data(), obj.Name.length());
+    }
+
+    WriteArray(f, _scene.Vertices);
+    WriteArray(f, _scene.Normals);
+    WriteArray(f, _scene.UV);
+
+    for (const Scene::Object& obj : _scene.Objects)
+    {
+      WriteArray(f, obj.Faces);
+    }
+
+    for (const Scene::Object& obj : _scene.Objects)
+    {
+      for (const std::vector<uint32_t>& lod : obj.Lods)
       {
-        if (start < (int)str.length())
-        {
-          res.push_back(str.substr(start, str.length()));
-        }
-        else
-        {
-          res.push_back("");
-        }
+        WriteArray(f, lod);
       }
-    } while (end != -1);
-
-    return res;
+    }
   }
 
-  // =============================================================================
+  // ===========================================================================
 
-  bool ModelLoader::Load(const std::string& fname)
+  bool ModelLoader::ReadFile(const std::string& fname, std::vector<char>& buf)
   {
-    _scene = Scene();
-
-    std::ifstream f(fname);
+    std::ifstream f(fname, std::ios::binary | std::ios::ate);
 
     if (not f.is_open())
     {
-      Error = EngineError::FAILED_TO_LOAD_MODEL;
       return false;
     }
 
-    std::string line;
+    std::streamsize size = f.tellg();
+
+    if (size < 0)
+    {
+      return false;
+    }
+
+    buf.resize(size);
+
+    f.seekg(0);
+
+    return (size == 0 or f.read(buf.data(), size));
+  }
+
+  // ===========================================================================
+
+  std::vector<ModelLoader::Chunk> ModelLoader::SplitIntoChunks(const char* begin,
+                                                               const char* end)
+  {
+    size_t threads = (_threadCount != 0)
+                   ? _threadCount
+                   : std::thread::hardware_concurrency();
+
+    size_t size  = end - begin;
+    size_t count = std::max(std::min(threads, size / kMinChunkSize), size_t(1));
+    size_t step  = size / count;
+
+    std::vector<Chunk> chunks;
 
-    size_t lineCount = 0;
+    chunks.reserve(count);
 
-    std::unique_ptr<Scene::Object> obj;
+    const char* p = begin;
 
-    while (std::getline(f, line))
+    for (size_t i = 0; i < count and p != end; i++)
     {
-      lineCount++;
+      Chunk chunk;
 
-      //
-      // Skip comments.
-      //
-      if (line.find_first_of('#') != std::string::npos
-       or line.length() == 0)
+      chunk.Begin = p;
+      chunk.End   = end;
+
+      if (i != count - 1)
       {
-        continue;
+        //
+        // Cut goes right after the end of line it falls into.
+        //
+        const char* cut = std::max(p, begin + step * (i + 1));
+        const char* eol = (const char*)std::memchr(cut, '\n', end - cut);
+
+        if (eol != nullptr)
+        {
+          chunk.End = eol + 1;
+        }
+      }
+
+      p = chunk.End;
+
+      chunks.push_back(chunk);
+    }
+
+    return chunks;
+  }
+
+  // ===========================================================================
+
+  ModelLoader::ObjStats ModelLoader::CountElements(const char* begin,
+                                                   const char* end) const
+  {
+    ObjStats stats;
+
+    ForEachLine(begin, end, [&stats](const char* p, const char* eol)
+    {
+      switch (GetLineType(p, eol))
+      {
+        case ObjFileLineType::OBJECT:
+          stats.FacesByObject.push_back(0);
+          break;
+
+        case ObjFileLineType::VERTEX:
+          stats.Vertices++;
+          break;
+
+        case ObjFileLineType::VERTEX_NORMAL:
+          stats.Normals++;
+          break;
+
+        case ObjFileLineType::VERTEX_TEXTURE:
+          stats.UV++;
+          break;
+
+        case ObjFileLineType::FACE:
+        {
+          if (stats.FacesByObject.empty())
+          {
+            stats.LeadingFaces++;
+          }
+          else
+          {
+            stats.FacesByObject.back()++;
+          }
+        }
+        break;
+
+        default:
+          break;
       }
 
-      ObjFileLineType type = ObjFileLineType::UNDEFINED;
+      return true;
+    });
+
+    return stats;
+  }
+
+  // ===========================================================================
+
+  void ModelLoader::Layout(std::vector<Chunk>& chunks)
+  {
+    WritePosition pos;
+
+    std::vector<size_t> facesByObject;
+
+    for (Chunk& chunk : chunks)
+    {
+      const ObjStats& stats = chunk.Stats;
 
       //
-      // Not doing syntax check or anything because fuck it.
+      // Faces before any 'o' in the whole file go to an unnamed object.
       //
-      StringV spl = StringSplit(line, ' ');
-      if (LineTypeByString.count(spl[0]) != 0)
+      if (stats.LeadingFaces != 0 and facesByObject.empty())
+      {
+        facesByObject.push_back(0);
+      }
+
+      chunk.Start        = pos;
+      chunk.Start.Object = facesByObject.size();
+      chunk.Start.Face   = facesByObject.empty() ? 0 : facesByObject.back();
+
+      if (stats.LeadingFaces != 0)
       {
-        type = LineTypeByString.at(spl[0]);
+        facesByObject.back() += stats.LeadingFaces;
       }
 
-      switch (type)
+      facesByObject.insert(facesByObject.end(),
+                           stats.FacesByObject.begin(),
+                           stats.FacesByObject.end());
+
+      pos.Vertex += stats.Vertices;
+      pos.Normal += stats.Normals;
+      pos.UV     += stats.UV;
+    }
+
+    _scene.Vertices.resize(pos.Vertex);
+    _scene.Normals.resize(pos.Normal);
+    _scene.UV.resize(pos.UV);
+
+    _scene.Objects.resize(facesByObject.size());
+
+    for (size_t i = 0; i < facesByObject.size(); i++)
+    {
+      _scene.Objects[i].Faces.resize(facesByObject[i]);
+    }
+  }
+
+  // ===========================================================================
+
+  bool ModelLoader::ParseBuffer(const Chunk& chunk, Scene& scene) const
+  {
+    WritePosition pos = chunk.Start;
+
+    return ForEachLine(chunk.Begin, chunk.End, [&](const char* p, const char* eol)
+    {
+      switch (GetLineType(p, eol))
       {
         case ObjFileLineType::OBJECT:
         {
-          //
-          // If single object only, don't push it right away.
-          //
-          if (obj != nullptr)
+          const char* name = SkipBlanks(p, eol);
+
+          p = name;
+
+          while (p != eol and not IsBlank(*p))
           {
-            _scene.Objects.push_back(*obj.get());
+            p++;
           }
 
-          obj = std::make_unique<Scene::Object>();
-          obj->Name = spl[1];
+          scene.Objects[pos.Object].Name.assign(name, p);
+
+          pos.Object++;
+          pos.Face = 0;
         }
         break;
 
-        // -----------------------------------------------------------------------
+        // ---------------------------------------------------------------------
 
         case ObjFileLineType::VERTEX:
         {
-          SW3D::Vec3 v =
+          if (not ParseVec3(p, eol, scene.Vertices[pos.Vertex++]))
           {
-            std::stod(spl[1]),
-            std::stod(spl[2]),
-            std::stod(spl[3])
-          };
-
-          _scene.Vertices.push_back(v);
+            return false;
+          }
         }
         break;
 
-        // -----------------------------------------------------------------------
+        // ---------------------------------------------------------------------
 
         case ObjFileLineType::VERTEX_NORMAL:
         {
-          SW3D::Vec3 v =
+          if (not ParseVec3(p, eol, scene.Normals[pos.Normal++]))
+          {
+            return false;
+          }
+        }
+        break;
+
+        // ---------------------------------------------------------------------
+
+        case ObjFileLineType::VERTEX_TEXTURE:
+        {
+          SW3D::Vec2& uv = scene.UV[pos.UV++];
+
+          if (not ParseDouble(p, eol, uv.X))
           {
-            std::stod(spl[1]),
-            std::stod(spl[2]),
-            std::stod(spl[3])
-          };
+            return false;
+          }
 
-          _scene.Normals.push_back(v);
+          //
+          // Second coordinate is optional.
+          //
+          if (SkipBlanks(p, eol) != eol and not ParseDouble(p, eol, uv.Y))
+          {
+            return false;
+          }
         }
         break;
 
-        // -----------------------------------------------------------------------
+        // ---------------------------------------------------------------------
 
         case ObjFileLineType::FACE:
         {
-          Scene::Object::Face f;
+          Scene::Object& obj = scene.Objects[pos.Object - 1];
+
+          Scene::Object::Face& f = obj.Faces[pos.Face++];
 
+          //
+          // Only triangles, so anything past third vertex is ignored.
+          // Indices are global across the file, so they're stored as is
+          // no matter which chunk they came from.
+          //
           for (size_t i = 0; i < 3; i++)
           {
-            auto& faceData = spl[i + 1];
-            auto sd = StringSplit(faceData, '/');
-            for (size_t j = 0; j < sd.size(); j++)
+            if (not ParseFaceVertex(p, eol, f.Indices[i]))
             {
-              //
-              // Indices are 1 based.
-              //
-              f.Indices[i][j] = sd[j].empty() ? -1 : (std::stoi(sd[j]) - 1);
+              return false;
             }
           }
-
-          obj->Faces.push_back(f);
         }
         break;
 
-        // -----------------------------------------------------------------------
+        // ---------------------------------------------------------------------
 
         default:
           break;
       }
+
+      return true;
+    });
+  }
+
+  // =============================================================================
+
+  bool ModelLoader::Load(const std::string& fname)
+  {
+    _scene = Scene();
+
+    if (_cacheEnabled and LoadCache(fname))
+    {
+      return true;
     }
 
     //
-    // In case of multiple objects we need not to forget to add last parsed
-    // one.
+    // Whole file is read at once and parsed in place, so nothing is
+    // allocated per line.
     //
-    if (obj != nullptr)
+    std::vector<char> buf;
+
+    if (not ReadFile(fname, buf))
     {
-      _scene.Objects.push_back(*obj.get());
+      Error = EngineError::FAILED_TO_LOAD_MODEL;
+      return false;
     }
 
-    f.close();
+    std::vector<Chunk> chunks = SplitIntoChunks(buf.data(),
+                                                buf.data() + buf.size());
+
+    //
+    // Counting first, so that every chunk knows where its stuff goes and
+    // scene is allocated once.
+    //
+    RunParallel(chunks.size(), [this, &chunks](size_t i)
+    {
+      chunks[i].Stats = CountElements(chunks[i].Begin, chunks[i].End);
+    });
+
+    Layout(chunks);
+
+    RunParallel(chunks.size(), [this, &chunks](size_t i)
+    {
+      chunks[i].Ok = ParseBuffer(chunks[i], _scene);
+    });
+
+    for (const Chunk& chunk : chunks)
+    {
+      if (not chunk.Ok)
+      {
+        _scene = Scene();
+        Error = EngineError::FAILED_TO_LOAD_MODEL;
+        return false;
+      }
+    }
 
     for (Scene::Object& obj : _scene.Objects)
     {
-      ToTriangles(obj);
+      BuildMeshes(obj, _optimizeVertexCache);
+      ComputeBounds(obj);
+
+      if (GetLodLevelsToBuild() != 0)
+      {
+        BuildLods(obj);
+      }
+    }
+
+    if (_cacheEnabled)
+    {
+      SaveCache(fname, buf);
     }
 
     return true;
@@ -217,4 +1296,39 @@ namespace SW3D
   {
     return _scene;
   }
+
+  // =============================================================================
+
+  void ModelLoader::SetThreadCount(size_t threads)
+  {
+    _threadCount = threads;
+  }
+
+  // =============================================================================
+
+  void ModelLoader::SetCacheEnabled(bool enabled)
+  {
+    _cacheEnabled = enabled;
+  }
+
+  // =============================================================================
+
+  void ModelLoader::SetMeshOutput(MeshOutput output)
+  {
+    _meshOutput = output;
+  }
+
+  // =============================================================================
+
+  void ModelLoader::SetOptimizeVertexCache(bool enabled)
+  {
+    _optimizeVertexCache = enabled;
+  }
+
+  // =============================================================================
+
+  void ModelLoader::SetLodLevels(size_t levels)
+  {
+    _lodLevels = levels;
+  }
 }
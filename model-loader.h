@@ -3,12 +3,9 @@
 
 #include <string>
 #include <vector>
-#include <unordered_map>
 
 #include "types.h"
 
-using StringV = std::vector<std::string>;
-
 namespace SW3D
 {
   class ModelLoader
@@ -43,6 +40,35 @@ namespace SW3D
           std::vector<Face> Faces;
 
           std::vector<Triangle> Triangles;
+
+          //
+          // Every distinct v/t/n combination used by faces is a vertex here,
+          // and every face is three indices into these. Faces referencing
+          // missing vertices are left out.
+          //
+          std::vector<Vertex>   VertexBuffer;
+          std::vector<uint32_t> IndexBuffer;
+
+          //
+          // Average cache miss ratio of faces as they were in the file and
+          // after reordering (see SetOptimizeVertexCache()), zeros if they
+          // weren't reordered.
+          //
+          double ACMRBefore = 0.0;
+          double ACMRAfter  = 0.0;
+
+          //
+          // Simplified versions of IndexBuffer over the same VertexBuffer,
+          // each with about a quarter of triangles of the previous one
+          // (see SetLodLevels()).
+          //
+          std::vector<std::vector<uint32_t>> Lods;
+
+          //
+          // Of vertices referenced by faces, in object space.
+          //
+          AABB           Bounds;
+          BoundingSphere Sphere;
         };
 
         std::vector<Object> Objects;
@@ -56,6 +82,40 @@ namespace SW3D
 
       const Scene& GetScene();
 
+      //
+      // Big files are split into chunks that are parsed in parallel, result
+      // is the same regardless. Zero means as many as there are hardware
+      // threads, one means no additional threads at all.
+      //
+      void SetThreadCount(size_t threads);
+
+      //
+      // Parsed scene is saved in binary next to the source file (as
+      // <fname>.sw3dmesh) and is loaded from there instead of parsing as
+      // long as source file stays the same.
+      //
+      void SetCacheEnabled(bool enabled);
+
+      //
+      // What objects get besides faces: expanded triangles, vertex and
+      // index buffers, or both. Triangles by default.
+      //
+      void SetMeshOutput(MeshOutput output);
+
+      //
+      // Faces of every object are reordered so that vertices shared by
+      // them are used close to each other, and vertex buffer follows
+      // that order. Costs some load time, unless model is cached.
+      //
+      void SetOptimizeVertexCache(bool enabled);
+
+      //
+      // Up to that many levels of detail for every object. They're made of
+      // vertex and index buffers, so mesh output has to include those.
+      // Objects that are too small or can't be simplified get fewer.
+      //
+      void SetLodLevels(size_t levels);
+
     private:
       enum class ObjFileLineType
       {
@@ -68,21 +128,180 @@ namespace SW3D
         FACE
       };
 
-      const std::unordered_map<std::string, ObjFileLineType> LineTypeByString =
+      //
+      // How much of everything there is in the file, so that everything can
+      // be allocated once before parsing.
+      //
+      struct ObjStats
       {
-        { "o",  ObjFileLineType::OBJECT         },
-        { "v",  ObjFileLineType::VERTEX         },
-        { "vn", ObjFileLineType::VERTEX_NORMAL  },
-        { "vt", ObjFileLineType::VERTEX_TEXTURE },
-        { "s",  ObjFileLineType::SHADING        },
-        { "f",  ObjFileLineType::FACE           }
+        size_t Vertices = 0;
+        size_t Normals  = 0;
+        size_t UV       = 0;
+
+        //
+        // Faces that come before any 'o' line.
+        //
+        size_t LeadingFaces = 0;
+
+        //
+        // Faces of every 'o' in the order they appear.
+        //
+        std::vector<size_t> FacesByObject;
       };
 
-      void ToTriangles(Scene::Object& obj);
+      //
+      // Where parsing of a chunk starts writing into the scene.
+      // Faces that come before any 'o' in the chunk continue the object
+      // Object - 1 from face Face on.
+      //
+      struct WritePosition
+      {
+        size_t Vertex = 0;
+        size_t Normal = 0;
+        size_t UV     = 0;
+        size_t Object = 0;
+        size_t Face   = 0;
+      };
+
+      struct Chunk
+      {
+        const char* Begin = nullptr;
+        const char* End   = nullptr;
+
+        ObjStats      Stats;
+        WritePosition Start;
+
+        bool Ok = false;
+      };
+
+      //
+      // Chunk is too small to be worth a thread if it's less than this.
+      //
+      static constexpr size_t kMinChunkSize = 1 << 20;
+
+      //
+      // Cache file is the header, then table of objects, then sizes of
+      // their LODs, then their names one after another, then vertices,
+      // normals, UV, faces of all objects one after another, and LODs of all
+      // objects one after another. Everything is in native byte order.
+      //
+      struct CacheHeader
+      {
+        char     Magic[4];
+        uint32_t Version;
+
+        //
+        // If size is the same but time is not, file is hashed to find out
+        // whether it has actually changed.
+        //
+        uint64_t SourceSize;
+        int64_t  SourceTime;
+        uint64_t SourceHash;
+
+        //
+        // Whether faces were reordered, see SetOptimizeVertexCache().
+        //
+        uint64_t Optimized;
+
+        //
+        // See GetLodLevelsToBuild(), and actually built in all objects.
+        //
+        uint64_t LodLevels;
+        uint64_t LodsCount;
+        uint64_t LodIndicesCount;
+
+        uint64_t VerticesCount;
+        uint64_t NormalsCount;
+        uint64_t UVCount;
+        uint64_t ObjectsCount;
+        uint64_t FacesCount;
+        uint64_t NamesSize;
+      };
+
+      struct CacheObject
+      {
+        uint64_t FacesCount;
+        uint64_t NameLength;
+
+        double BoundsMin[3];
+        double BoundsMax[3];
+        double SphereCenter[3];
+        double SphereRadius;
+
+        double ACMRBefore;
+        double ACMRAfter;
+
+        uint64_t LodsCount;
+      };
+
+      static constexpr char     kCacheMagic[4] = { 'S', 'W', '3', 'M' };
+      static constexpr uint32_t kCacheVersion  = 4;
+
+      bool LoadCache(const std::string& fname);
+      void SaveCache(const std::string& fname, const std::vector<char>& source);
+
+      bool ReadFile(const std::string& fname, std::vector<char>& buf);
+
+      //
+      // Line aligned, at least kMinChunkSize each except the last one.
+      //
+      std::vector<Chunk> SplitIntoChunks(const char* begin, const char* end);
+
+      ObjStats CountElements(const char* begin, const char* end) const;
+
+      //
+      // Sizes the whole scene from chunks stats and decides where each
+      // chunk goes, so that chunks can be parsed in any order.
+      //
+      void Layout(std::vector<Chunk>& chunks);
+
+      //
+      // Parses lines of the chunk into already sized scene.
+      //
+      bool ParseBuffer(const Chunk& chunk, Scene& scene) const;
 
-      StringV StringSplit(const std::string& str, char delim);
+      static ObjFileLineType GetLineType(const char*& p, const char* end);
+
+      //
+      // Reordering of faces is done only once, cached ones already are.
+      //
+      void BuildMeshes(Scene::Object& obj, bool optimize);
+
+      void OptimizeFaces(Scene::Object& obj);
+
+      void BuildLods(Scene::Object& obj);
+
+      //
+      // LODs need index buffers, so with triangles only output there are
+      // none whatever SetLodLevels() says.
+      //
+      size_t GetLodLevelsToBuild() const;
+
+      //
+      // Simplifying further than that is not worth it.
+      //
+      static constexpr size_t kMinLodTriangles = 32;
+
+      void ToTriangles(Scene::Object& obj);
+      void ToIndexed(Scene::Object& obj);
+      void ComputeBounds(Scene::Object& obj);
 
       Scene _scene;
+
+      size_t _threadCount = 0;
+
+      bool _cacheEnabled = false;
+
+      MeshOutput _meshOutput = MeshOutput::TRIANGLES;
+
+      bool _optimizeVertexCache = false;
+
+      size_t _lodLevels = 0;
+
+      //
+      // First vertex in VertexBuffer with given position, see ToIndexed().
+      //
+      std::vector<uint32_t> _firstByPosition;
   };
 }
 
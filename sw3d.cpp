@@ -2,8 +2,435 @@
 
 namespace SW3D
 {
+  void DepthBuffer::Init(size_t width, size_t height, DepthFormat format)
+  {
+    _format = format;
+
+    _width  = width;
+    _height = height;
+
+    _tilesX = (_width  + kTileSize - 1) / kTileSize;
+    _tilesY = (_height + kTileSize - 1) / kTileSize;
+
+    //
+    // Pad to whole tiles so that tile fill never has to care about buffer
+    // edges, and keep rows 64 byte aligned.
+    //
+    size_t elementsPerLine = 64 / ElementSize();
+
+    _pitch = _tilesX * kTileSize;
+    _pitch = ( (_pitch + elementsPerLine - 1) / elementsPerLine )
+             * elementsPerLine;
+
+    _storage.assign(_pitch * _tilesY * kTileSize * ElementSize() + 64, 0);
+
+    uintptr_t addr = (uintptr_t)_storage.data();
+    _data = _storage.data() + ( (64 - (addr % 64)) % 64 );
+
+    switch (_format)
+    {
+      case DepthFormat::FLOAT32:
+      {
+        float inf = std::numeric_limits<float>::infinity();
+        std::memcpy(&_clearValue, &inf, sizeof(float));
+      }
+      break;
+
+      case DepthFormat::UNORM24:
+        _clearValue = 0xFFFFFF;
+        break;
+
+      case DepthFormat::UNORM16:
+        _clearValue = 0xFFFF;
+        break;
+    }
+
+    //
+    // Zero generation is never current, so every tile starts as stale.
+    //
+    _tileGeneration.assign(_tilesX * _tilesY, 0);
+    _generation = 1;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DepthBuffer::Clear()
+  {
+    _generation++;
+
+    //
+    // Once in 4 billion clears we have to do it for real.
+    //
+    if (_generation == 0)
+    {
+      std::fill(_tileGeneration.begin(), _tileGeneration.end(), 0);
+      _generation = 1;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DepthBuffer::PrepareTile(int tileX, int tileY)
+  {
+    uint32_t& gen = _tileGeneration[tileY * _tilesX + tileX];
+
+    if (gen == _generation)
+    {
+      return;
+    }
+
+    gen = _generation;
+
+    size_t x0 = tileX * kTileSize;
+    size_t y0 = tileY * kTileSize;
+
+    for (size_t y = y0; y < y0 + kTileSize; y++)
+    {
+      if (_format == DepthFormat::UNORM16)
+      {
+        uint16_t* row = (uint16_t*)_data + y * _pitch + x0;
+        std::fill(row, row + kTileSize, (uint16_t)_clearValue);
+      }
+      else
+      {
+        uint32_t* row = (uint32_t*)_data + y * _pitch + x0;
+        std::fill(row, row + kTileSize, _clearValue);
+      }
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool DepthBuffer::IsTileValid(int x, int y) const
+  {
+    return _tileGeneration[(y >> kTileShift) * _tilesX + (x >> kTileShift)]
+           == _generation;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  uint32_t DepthBuffer::Encode(double depth) const
+  {
+    switch (_format)
+    {
+      case DepthFormat::FLOAT32:
+      {
+        float f = (float)depth;
+        uint32_t res;
+        std::memcpy(&res, &f, sizeof(float));
+        return res;
+      }
+
+      case DepthFormat::UNORM24:
+        return (uint32_t)(Clamp(depth, 0.0, 1.0) * (double)0xFFFFFF + 0.5);
+
+      case DepthFormat::UNORM16:
+        return (uint32_t)(Clamp(depth, 0.0, 1.0) * (double)0xFFFF + 0.5);
+    }
+
+    return _clearValue;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool DepthBuffer::Test(int x, int y, double depth) const
+  {
+    //
+    // Stale tile is as far as it gets, so only NaN wouldn't pass.
+    //
+    if (not IsTileValid(x, y))
+    {
+      return (depth == depth);
+    }
+
+    size_t i = y * _pitch + x;
+
+    switch (_format)
+    {
+      case DepthFormat::FLOAT32:
+        return ((float)depth < ((const float*)_data)[i]);
+
+      case DepthFormat::UNORM24:
+        return (Encode(depth) < ((const uint32_t*)_data)[i]);
+
+      case DepthFormat::UNORM16:
+        return (Encode(depth) < ((const uint16_t*)_data)[i]);
+    }
+
+    return false;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool DepthBuffer::TestAndSet(int x, int y, double depth)
+  {
+    PrepareTile(x >> kTileShift, y >> kTileShift);
+
+    size_t i = y * _pitch + x;
+
+    switch (_format)
+    {
+      case DepthFormat::FLOAT32:
+      {
+        float& dst = ((float*)_data)[i];
+        if ((float)depth < dst)
+        {
+          dst = (float)depth;
+          return true;
+        }
+      }
+      break;
+
+      case DepthFormat::UNORM24:
+      {
+        uint32_t& dst = ((uint32_t*)_data)[i];
+        uint32_t code = Encode(depth);
+        if (code < dst)
+        {
+          dst = code;
+          return true;
+        }
+      }
+      break;
+
+      case DepthFormat::UNORM16:
+      {
+        uint16_t& dst = ((uint16_t*)_data)[i];
+        uint32_t code = Encode(depth);
+        if (code < dst)
+        {
+          dst = (uint16_t)code;
+          return true;
+        }
+      }
+      break;
+    }
+
+    return false;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  double DepthBuffer::Read(int x, int y) const
+  {
+    size_t i = y * _pitch + x;
+
+    bool valid = IsTileValid(x, y);
+
+    switch (_format)
+    {
+      case DepthFormat::FLOAT32:
+        return valid
+               ? ((const float*)_data)[i]
+               : std::numeric_limits<double>::infinity();
+
+      case DepthFormat::UNORM24:
+        return valid
+               ? ((const uint32_t*)_data)[i] / (double)0xFFFFFF
+               : 1.0;
+
+      case DepthFormat::UNORM16:
+        return valid
+               ? ((const uint16_t*)_data)[i] / (double)0xFFFF
+               : 1.0;
+    }
+
+    return 0.0;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  uint8_t* DepthBuffer::Data()
+  {
+    return _data;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const uint8_t* DepthBuffer::Data() const
+  {
+    return _data;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const size_t& DepthBuffer::Width() const
+  {
+    return _width;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const size_t& DepthBuffer::Height() const
+  {
+    return _height;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const size_t& DepthBuffer::Pitch() const
+  {
+    return _pitch;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const DepthFormat& DepthBuffer::Format() const
+  {
+    return _format;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  size_t DepthBuffer::ElementSize() const
+  {
+    return (_format == DepthFormat::UNORM16) ? sizeof(uint16_t)
+                                             : sizeof(uint32_t);
+  }
+
+  // ===========================================================================
+
+  WorkerPool::~WorkerPool()
+  {
+    Stop();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void WorkerPool::Start(size_t threadsTotal)
+  {
+    Stop();
+
+    if (threadsTotal == 0)
+    {
+      threadsTotal = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    _quit    = false;
+    _started = true;
+
+    for (size_t i = 1; i < threadsTotal; i++)
+    {
+      _threads.emplace_back(&WorkerPool::WorkerLoop, this, _jobId);
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void WorkerPool::Stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _quit = true;
+    }
+
+    _jobReady.notify_all();
+
+    for (auto& t : _threads)
+    {
+      t.join();
+    }
+
+    _threads.clear();
+
+    _started = false;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  size_t WorkerPool::Size() const
+  {
+    return _started ? _threads.size() + 1 : 0;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void WorkerPool::ParallelFor(size_t count,
+                               const std::function<void(size_t)>& job)
+  {
+    if (_threads.empty() or count <= 1)
+    {
+      for (size_t i = 0; i < count; i++)
+      {
+        job(i);
+      }
+
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+
+      _job   = &job;
+      _count = count;
+      _next  = 0;
+      _busy  = _threads.size();
+
+      _jobId++;
+    }
+
+    _jobReady.notify_all();
+
+    Drain();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _jobDone.wait(lock, [this]() { return (_busy == 0); });
+
+    _job = nullptr;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void WorkerPool::Drain()
+  {
+    for (size_t i = _next++; i < _count; i = _next++)
+    {
+      (*_job)(i);
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void WorkerPool::WorkerLoop(uint64_t lastJobId)
+  {
+    while (true)
+    {
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        _jobReady.wait(lock, [this, lastJobId]()
+        {
+          return (_quit or _jobId != lastJobId);
+        });
+
+        if (_quit)
+        {
+          return;
+        }
+
+        lastJobId = _jobId;
+      }
+
+      Drain();
+
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _busy--;
+      }
+
+      _jobDone.notify_one();
+    }
+  }
+
+  // ===========================================================================
+
   DrawWrapper::~DrawWrapper()
   {
+    //
+    // Nobody is going to see it anyway.
+    //
+    _pipeline.clear();
+
     for (auto& kvp : _texturesByHandle)
     {
       FreeTexture(kvp.first);
@@ -24,17 +451,154 @@ namespace SW3D
       return false;
     }
 
-    if (qualityReductionFactor == 0)
+    SDL_LogSetAllPriority(SDL_LOG_PRIORITY_DEBUG);
+
+    if (not InitFrameBufferSize(windowWidth,
+                                windowHeight,
+                                qualityReductionFactor))
     {
-      SDL_Log("Resolution factor cannot be zero!");
       return false;
     }
 
-    SDL_LogSetAllPriority(SDL_LOG_PRIORITY_DEBUG);
-
-    uint16_t canvasSize = std::min(windowWidth, windowHeight);
+    SDL_DisplayMode dm;
+    if (SDL_GetCurrentDisplayMode(0, &dm) < 0)
+    {
+      SDL_Log("SDL_GetCurrentDisplayMode() error: %s", SDL_GetError());
+      return false;
+    }
 
-    //
+    _window = SDL_CreateWindow(_windowName.data(),
+                               dm.w / 2 - _windowWidth / 2,
+                               dm.h / 2 - _windowHeight / 2,
+                               _windowWidth,
+                               _windowHeight,
+                               SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+
+    if (_window == nullptr)
+    {
+      SDL_Log("SDL_CreateWindow() error: %s", SDL_GetError());
+      return false;
+    }
+
+    const char* driverHint = "opengl";
+
+    SDL_bool ok = SDL_SetHint(SDL_HINT_RENDER_DRIVER, driverHint);
+    if (ok == SDL_FALSE)
+    {
+      SDL_Log("Hint value '%s' could not be set! (SDL_HINT_RENDER_DRIVER)",
+              driverHint);
+    }
+
+    //
+    // Old versions of SDL2 don't support subpixel drawing hints.
+    // Out of the box subpixel precision line drawing works only with this
+    // hint set to "2" or "3" on Windows. It is unclear which one is better,
+    // but I decided to use "3". Not sure if it works at all for subpixel points
+    // drawing since test project (cr) showed no difference.
+    // Maybe disable it eventually or implement custom subpixel drawing somehow.
+    //
+#if (SDL_MAJOR_VERSION == 2 and SDL_MINOR_VERSION == 0 and SDL_PATCHLEVEL >= 20) \
+ or (SDL_MAJOR_VERSION >= 2 and SDL_MINOR_VERSION > 0)
+    const char* lineHint = "3";
+
+    ok = SDL_SetHint(SDL_HINT_RENDER_LINE_METHOD, lineHint);
+    if (ok == SDL_FALSE)
+    {
+      SDL_Log("Hint value '%s' couldn't be set! (SDL_HINT_RENDER_LINE_METHOD)",
+              lineHint);
+    }
+#endif
+
+    _renderer = SDL_CreateRenderer(_window, -1, SDL_RENDERER_ACCELERATED);
+    if (_renderer == nullptr)
+    {
+      SDL_Log("Failed to create renderer with SDL_RENDERER_ACCELERATED"
+              " - falling back to software");
+
+      _renderer = SDL_CreateRenderer(_window, -1, SDL_RENDERER_SOFTWARE);
+      if (_renderer == nullptr)
+      {
+        SDL_Log("Failed to create renderer: %s", SDL_GetError());
+        return false;
+      }
+    }
+
+    _framebuffer = SDL_CreateTexture(_renderer,
+                                     SDL_PIXELFORMAT_RGBA32,
+                                     SDL_TEXTUREACCESS_TARGET,
+                                     _frameBufferSize,
+                                     _frameBufferSize);
+    if (_framebuffer == nullptr)
+    {
+      SDL_Log("Failed to create framebuffer: %s", SDL_GetError());
+      return false;
+    }
+
+    _colorBufferTexture = SDL_CreateTexture(_renderer,
+                                            SDL_PIXELFORMAT_ARGB8888,
+                                            SDL_TEXTUREACCESS_STREAMING,
+                                            _frameBufferSize,
+                                            _frameBufferSize);
+    if (_colorBufferTexture == nullptr)
+    {
+      SDL_Log("Failed to create color buffer texture: %s", SDL_GetError());
+      return false;
+    }
+
+    SDL_SetTextureBlendMode(_colorBufferTexture, SDL_BLENDMODE_BLEND);
+
+    SDL_SetRenderDrawColor(_renderer, 0, 0, 0, 255);
+
+    InitBuffersAndMatrices();
+
+    PostInit();
+
+    return true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool DrawWrapper::InitHeadless(uint16_t width,
+                                 uint16_t height,
+                                 size_t framesToRender,
+                                 uint16_t qualityReductionFactor)
+  {
+    //
+    // Nothing from SDL besides logging and surface saving is used in this
+    // mode, and both work without SDL_Init().
+    //
+    SDL_LogSetAllPriority(SDL_LOG_PRIORITY_DEBUG);
+
+    if (not InitFrameBufferSize(width, height, qualityReductionFactor))
+    {
+      return false;
+    }
+
+    _headless       = true;
+    _framesToRender = framesToRender;
+
+    InitBuffersAndMatrices();
+
+    PostInit();
+
+    return true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool DrawWrapper::InitFrameBufferSize(uint16_t width,
+                                        uint16_t height,
+                                        uint16_t qualityReductionFactor)
+  {
+    if (qualityReductionFactor == 0)
+    {
+      SDL_Log("Resolution factor cannot be zero!");
+      return false;
+    }
+
+    uint16_t canvasSize = std::min(width, height);
+
+    //
     // Cannot add extra 1 to account for pretty debug grid size because
     // it will actually downscale texture into the screen on SDL_RenderCopy
     // by 1 pixel and thus introduce artifacts when in full resolution
@@ -42,882 +606,3185 @@ namespace SW3D
     //
     _frameBufferSize = canvasSize / qualityReductionFactor;
 
-    if (_frameBufferSize == 0)
+    if (_frameBufferSize == 0)
+    {
+      SDL_Log("Canvas size is zero - increase quality!");
+      return false;
+    }
+
+    _windowWidth  = width;
+    _windowHeight = height;
+
+    return true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::InitBuffersAndMatrices()
+  {
+    _colorBuffer.resize(_frameBufferSize * _frameBufferSize, 0);
+
+    _depthBuffer.Init(_frameBufferSize, _frameBufferSize);
+
+    _binsX = (_frameBufferSize + kBinSize - 1) / kBinSize;
+    _binsY = (_frameBufferSize + kBinSize - 1) / kBinSize;
+
+    _bins.resize(_binsX * _binsY);
+
+    _pipeline.reserve(kPipelineReserve);
+
+    _workers.Start(_threadCount);
+
+    _aspectRatio = (double)_windowHeight / (double)_windowWidth;
+
+    SetProjectionMatrix(Matrix4::Identity());
+    SetModelViewMatrix(Matrix4::Identity());
+
+    //
+    // Both stacks contain identity matrices OpenGL style, and since identity
+    // matrix is basically orthographic projection save corresponding mode as
+    // well.
+    //
+    _projectionStack[0] = { _projectionMatrix, ProjectionMode::ORTHOGRAPHIC };
+    _modelViewStack[0]  = _modelViewMatrix;
+
+    _projectionStackSize = 1;
+    _modelViewStackSize  = 1;
+
+    _initialized = true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::Run(bool debugMode)
+  {
+    INIT_CHECK();
+
+    if (_headless)
+    {
+      RunHeadless(debugMode);
+      return;
+    }
+
+    SDL_Event evt;
+
+    Clock::time_point measureStart;
+    Clock::time_point measureEnd;
+
+    ns dt = ns{0};
+
+    while (_running)
+    {
+      _drawCalls = 0;
+
+      measureStart = Clock::now();
+      measureEnd = measureStart;
+
+      while (SDL_PollEvent(&evt))
+      {
+        HandleEvent(evt);
+      }
+
+      SDL_SetRenderTarget(_renderer, _framebuffer);
+      SDL_RenderClear(_renderer);
+
+      ClearColorBuffer();
+
+      if (debugMode)
+      {
+        DrawGrid();
+      }
+
+      DrawToFrameBuffer();
+
+      UploadColorBuffer();
+
+      SDL_SetRenderTarget(_renderer, nullptr);
+      SDL_RenderClear(_renderer);
+
+      int ok = SDL_RenderCopy(_renderer, _framebuffer, nullptr, nullptr);
+      if (ok < 0)
+      {
+        SDL_Log("%s", SDL_GetError());
+      }
+
+      DrawToScreen();
+
+      SDL_RenderPresent(_renderer);
+
+      _fps++;
+
+      measureEnd = Clock::now();
+      dt = measureEnd - measureStart;
+
+      _deltaTime = std::chrono::duration<double>(dt).count();
+      _dtAcc += _deltaTime;
+
+      if (_dtAcc > 1.0)
+      {
+        static char buf[128];
+
+        ::snprintf(buf, sizeof(buf), "FPS: %u", _fps);
+        SDL_SetWindowTitle(_window, buf);
+
+        _dtAcc = 0.0;
+        _fps = 0;
+      }
+    }
+
+    SDL_Log("Goodbye!");
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::RunHeadless(bool debugMode)
+  {
+    Clock::time_point measureStart;
+
+    ns dt = ns{0};
+    ns total = ns{0};
+
+    size_t frame = 0;
+
+    static char buf[64];
+
+    while (_running and frame < _framesToRender)
+    {
+      _drawCalls = 0;
+
+      measureStart = Clock::now();
+
+      ClearColorBuffer();
+
+      if (debugMode)
+      {
+        DrawGrid();
+      }
+
+      DrawToFrameBuffer();
+
+      dt = Clock::now() - measureStart;
+
+      //
+      // Frame dumping is I/O, so it's not accounted in delta time.
+      //
+      if (not _frameDumpPrefix.empty())
+      {
+        ::snprintf(buf, sizeof(buf), "%06zu.%s",
+                   frame,
+                   (_frameDumpFormat == ImageFormat::BMP) ? "bmp" : "ppm");
+
+        if (not SaveFrame(_frameDumpPrefix + buf, _frameDumpFormat))
+        {
+          SDL_Log("%s", SW3D::ErrorToString());
+        }
+      }
+
+      _deltaTime = std::chrono::duration<double>(dt).count();
+
+      total += dt;
+      frame++;
+    }
+
+    double totalSec = std::chrono::duration<double>(total).count();
+
+    SDL_Log("Rendered %zu frames in %.4f s (%.2f FPS, %.4f ms per frame)",
+            frame,
+            totalSec,
+            (totalSec > 0.0) ? (frame / totalSec) : 0.0,
+            (frame != 0) ? (totalSec * 1000.0 / frame) : 0.0);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::SetFrameDump(const std::string& fnamePrefix,
+                                 ImageFormat format)
+  {
+    _frameDumpPrefix = fnamePrefix;
+    _frameDumpFormat = format;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool DrawWrapper::SaveFrame(const std::string& fname, ImageFormat format)
+  {
+    if (_colorBuffer.empty())
+    {
+      SW3D::Error = EngineError::NOT_INITIALIZED;
+      return false;
+    }
+
+    switch (format)
+    {
+      case ImageFormat::PPM:
+      {
+        std::ofstream f(fname, std::ios::binary);
+        if (not f.is_open())
+        {
+          SW3D::Error = EngineError::FAILED_TO_SAVE_IMAGE;
+          return false;
+        }
+
+        f << "P6\n" << _frameBufferSize << " " << _frameBufferSize << "\n255\n";
+
+        std::vector<uint8_t> row(_frameBufferSize * 3);
+
+        for (size_t y = 0; y < _frameBufferSize; y++)
+        {
+          const uint32_t* src = &_colorBuffer[y * _frameBufferSize];
+
+          for (size_t x = 0; x < _frameBufferSize; x++)
+          {
+            row[x * 3 + 0] = (src[x] & _maskR) >> 16;
+            row[x * 3 + 1] = (src[x] & _maskG) >> 8;
+            row[x * 3 + 2] = (src[x] & _maskB);
+          }
+
+          f.write((const char*)row.data(), row.size());
+        }
+
+        if (not f.good())
+        {
+          SW3D::Error = EngineError::FAILED_TO_SAVE_IMAGE;
+          return false;
+        }
+      }
+      break;
+
+      case ImageFormat::BMP:
+      {
+        SDL_Surface* surf =
+          SDL_CreateRGBSurfaceWithFormatFrom(_colorBuffer.data(),
+                                             _frameBufferSize,
+                                             _frameBufferSize,
+                                             32,
+                                             _frameBufferSize * sizeof(uint32_t),
+                                             SDL_PIXELFORMAT_ARGB8888);
+        if (surf == nullptr)
+        {
+          SDL_Log("%s", SDL_GetError());
+          SW3D::Error = EngineError::FAILED_TO_SAVE_IMAGE;
+          return false;
+        }
+
+        int res = SDL_SaveBMP(surf, fname.data());
+
+        SDL_FreeSurface(surf);
+
+        if (res != 0)
+        {
+          SDL_Log("%s", SDL_GetError());
+          SW3D::Error = EngineError::FAILED_TO_SAVE_IMAGE;
+          return false;
+        }
+      }
+      break;
+
+      default:
+        SW3D::Error = EngineError::INVALID_MODE;
+        return false;
+    }
+
+    return true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  int DrawWrapper::LoadTexture(const std::string& fname)
+  {
+    if (_textureHandleByFname.count(fname) == 1)
+    {
+      SDL_Log("Texture '%s' already loaded (handle %d) - reloading",
+              fname.data(), _textureHandleByFname[fname]);
+      FreeTexture(_textureHandleByFname[fname]);
+
+      //
+      // Reloaded one gets new handle, this one is gone for good.
+      //
+      _texturesByHandle.erase(_textureHandleByFname[fname]);
+      _textureHandleByFname.erase(fname);
+    }
+
+    SDL_Surface* surf = SDL_LoadBMP(fname.data());
+    if (surf == nullptr)
+    {
+      SDL_Log("SDL_LoadBMP() fail - %s", SDL_GetError());
+      return -1;
+    }
+
+    SDL_Texture* tex = nullptr;
+
+    //
+    // Without renderer there's nothing to create texture with, but surface is
+    // all that is needed for ReadTexel() anyway.
+    //
+    if (not _headless)
+    {
+      //
+      // No transparency for now.
+      //
+      tex = SDL_CreateTextureFromSurface(_renderer, surf);
+    }
+
+    if (tex == nullptr and not _headless)
+    {
+      SDL_FreeSurface(surf);
+      SDL_Log("SDL_CreateTextureFromSurface() fail - %s", SDL_GetError());
+      return -1;
+    }
+
+    _textureHandleCounter++;
+
+    TextureData& td = _texturesByHandle[_textureHandleCounter];
+
+    td.Filename = fname;
+    td.Surface  = surf;
+    td.Texture  = tex;
+
+    //
+    // Rasterizer doesn't want to know anything about pixel formats.
+    //
+    if (not ConvertTexels(td))
+    {
+      SDL_Log("SDL_ConvertSurfaceFormat() fail - %s", SDL_GetError());
+      FreeTexture(_textureHandleCounter);
+      _texturesByHandle.erase(_textureHandleCounter);
+      return -1;
+    }
+
+    SDL_Log("%s", ToString(_texturesByHandle[_textureHandleCounter]).data());
+
+    _textureHandleByFname[fname] = _textureHandleCounter;
+
+    return _textureHandleCounter;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  uint32_t DrawWrapper::ReadTexel(int handle, int x, int y, bool wrap)
+  {
+    auto it = _texturesByHandle.find(handle);
+
+    if (it == _texturesByHandle.end())
+    {
+      SDL_Log("Texture handle %d not found!", handle);
+      return -1;
+    }
+
+    return ReadTexel(it->second, x, y, wrap);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  uint32_t DrawWrapper::ReadTexel(const TextureData& td,
+                                  int x,
+                                  int y,
+                                  bool wrap)
+  {
+    if (td.Texels.empty())
+    {
+      return -1;
+    }
+
+    int nx = x;
+    int ny = y;
+
+    if (wrap)
+    {
+      nx %= td.Width;
+      ny %= td.Height;
+
+      //
+      // Remainder keeps the sign, so negative coordinates need a nudge.
+      //
+      if (nx < 0)
+      {
+        nx += td.Width;
+      }
+
+      if (ny < 0)
+      {
+        ny += td.Height;
+      }
+    }
+    else
+    {
+      nx = Clamp(nx, 0, td.Width  - 1);
+      ny = Clamp(ny, 0, td.Height - 1);
+    }
+
+    return td.Texels[ny * td.Width + nx];
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool DrawWrapper::ConvertTexels(TextureData& td)
+  {
+    //
+    // BMP can be anything from 1 to 32 bits per pixel, palettized or not,
+    // so SDL gets to deal with that.
+    //
+    SDL_Surface* argb = SDL_ConvertSurfaceFormat(td.Surface,
+                                                 SDL_PIXELFORMAT_ARGB8888,
+                                                 0);
+    if (argb == nullptr)
+    {
+      return false;
+    }
+
+    td.Width  = argb->w;
+    td.Height = argb->h;
+
+    td.Texels.resize((size_t)td.Width * td.Height);
+
+    //
+    // SDL makes pixels without alpha opaque, ours stay zero as they always
+    // were.
+    //
+    uint32_t alphaMask = (td.Surface->format->Amask != 0) ? 0xFFFFFFFF
+                                                          : 0x00FFFFFF;
+
+    for (int y = 0; y < td.Height; y++)
+    {
+      //
+      // Packed format, so it's native uint32_t already, rows may be padded
+      // though.
+      //
+      const uint32_t* row = (const uint32_t*)( (const uint8_t*)argb->pixels
+                                              + y * argb->pitch );
+
+      uint32_t* dst = td.Texels.data() + (size_t)y * td.Width;
+
+      for (int x = 0; x < td.Width; x++)
+      {
+        dst[x] = row[x] & alphaMask;
+      }
+    }
+
+    SDL_FreeSurface(argb);
+
+    auto pow2 = [](int size)
+    {
+      uint32_t shift = 0;
+
+      while ((1 << shift) < size)
+      {
+        shift++;
+      }
+
+      return shift;
+    };
+
+    uint32_t shiftX = pow2(td.Width);
+    uint32_t shiftY = pow2(td.Height);
+
+    int w = (1 << shiftX);
+    int h = (1 << shiftY);
+
+    td.Pow2Texels.clear();
+
+    //
+    // Texture coordinates are normalized, so scaling doesn't change what
+    // goes where, just how many texels there are.
+    //
+    if (w != td.Width or h != td.Height)
+    {
+      td.Pow2Texels.resize((size_t)w * h);
+
+      for (int y = 0; y < h; y++)
+      {
+        int srcY = (int)( (int64_t)y * td.Height / h );
+
+        for (int x = 0; x < w; x++)
+        {
+          int srcX = (int)( (int64_t)x * td.Width / w );
+
+          td.Pow2Texels[y * w + x] = td.Texels[srcY * td.Width + srcX];
+        }
+      }
+    }
+
+    Sampler& smp = td.Sampler_;
+
+    smp.Texels = td.Pow2Texels.empty() ? td.Texels.data()
+                                       : td.Pow2Texels.data();
+    smp.Width  = w;
+    smp.Height = h;
+    smp.MaskX  = w - 1;
+    smp.MaskY  = h - 1;
+    smp.ShiftY = shiftX;
+
+    return true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  DrawWrapper::TextureData* DrawWrapper::GetTexture(int handle)
+  {
+    return (_texturesByHandle.count(handle) == 1)
+          ? &_texturesByHandle[handle]
+          : nullptr;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const DrawWrapper::Sampler* DrawWrapper::GetSampler(int handle)
+  {
+    const TextureData* td = GetTexture(handle);
+
+    return (td != nullptr and td->Sampler_.Texels != nullptr)
+          ? &td->Sampler_
+          : nullptr;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::Stop()
+  {
+    _running = false;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::DrawPoint(const SDL_Point &p, uint32_t colorMask)
+  {
+    INIT_CHECK();
+
+    _drawCalls++;
+
+    PutPixel(p.x, p.y, colorMask);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::DrawLine(const SDL_Point& p1,
+                             const SDL_Point& p2,
+                             uint32_t colorMask)
+  {
+    INIT_CHECK();
+
+    _drawCalls++;
+
+    int x1 = p1.x;
+    int y1 = p1.y;
+    int x2 = p2.x;
+    int y2 = p2.y;
+
+    //
+    // SDL used to do this for us, now we have to clip by ourselves or else
+    // line that goes way off screen will be walked pixel by pixel.
+    //
+    SDL_Rect canvas = { 0, 0, (int)_frameBufferSize, (int)_frameBufferSize };
+
+    if (not SDL_IntersectRectAndLine(&canvas, &x1, &y1, &x2, &y2))
+    {
+      return;
+    }
+
+    //
+    // Plain old Bresenham for all octants.
+    //
+    int dx =  std::abs(x2 - x1);
+    int dy = -std::abs(y2 - y1);
+
+    int sx = (x1 < x2) ? 1 : -1;
+    int sy = (y1 < y2) ? 1 : -1;
+
+    int err = dx + dy;
+
+    while (true)
+    {
+      PutPixel(x1, y1, colorMask);
+
+      if (x1 == x2 and y1 == y2)
+      {
+        break;
+      }
+
+      int e2 = 2 * err;
+
+      if (e2 >= dy)
+      {
+        err += dy;
+        x1  += sx;
+      }
+
+      if (e2 <= dx)
+      {
+        err += dx;
+        y1  += sy;
+      }
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::DrawTriangle(const SDL_Point& p1,
+                                 const SDL_Point& p2,
+                                 const SDL_Point& p3,
+                                 uint32_t colorMask,
+                                 RenderMode mode)
+  {
+    INIT_CHECK();
+
+    switch (mode)
+    {
+      case RenderMode::SOLID:
+        FillTriangle(p1, p2, p3, colorMask);
+        break;
+
+      case RenderMode::WIREFRAME:
+        DrawLine(p1, p2, colorMask);
+        DrawLine(p2, p3, colorMask);
+        DrawLine(p1, p3, colorMask);
+        break;
+
+      case RenderMode::MIXED:
+        FillTriangle(p1, p2, p3, colorMask);
+        DrawLine(p1, p2, 0);
+        DrawLine(p2, p3, 0);
+        DrawLine(p1, p3, 0);
+        break;
+
+      default:
+        SDL_Log("Unexpected mode %d!", (int)mode);
+        break;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::DrawTriangle(const Vec3& p1,
+                                 const Vec3& p2,
+                                 const Vec3& p3,
+                                 uint32_t colorMask,
+                                 RenderMode mode)
+  {
+    INIT_CHECK();
+
+    //
+    // Only fill has subpixel precision, lines still go through SDL_Point.
+    //
+    if (_rasterizerKind == RasterizerKind::TILED
+    and mode != RenderMode::WIREFRAME
+    and RasterizeSubpixel(p1, p2, p3, false, colorMask))
+    {
+      _drawCalls++;
+
+      if (mode == RenderMode::SOLID)
+      {
+        return;
+      }
+
+      mode = RenderMode::WIREFRAME;
+      colorMask = 0;
+    }
+
+    DrawTriangle(SDL_Point{ (int32_t)p1.X, (int32_t)p1.Y },
+                 SDL_Point{ (int32_t)p2.X, (int32_t)p2.Y },
+                 SDL_Point{ (int32_t)p3.X, (int32_t)p3.Y },
+                 colorMask,
+                 mode);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::FillTriangle(const SDL_Point& p1,
+                                 const SDL_Point& p2,
+                                 const SDL_Point& p3,
+                                 uint32_t colorMask)
+  {
+    INIT_CHECK();
+
+    _drawCalls++;
+
+    RasterizeTriangle(p1, p2, p3, nullptr, colorMask);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::FillTriangle(const Vec3& p1,
+                                 const Vec3& p2,
+                                 const Vec3& p3,
+                                 uint32_t colorMask)
+  {
+    INIT_CHECK();
+
+    _drawCalls++;
+
+    if (_rasterizerKind == RasterizerKind::TILED
+    and RasterizeSubpixel(p1, p2, p3, true, colorMask))
+    {
+      return;
+    }
+
+    //
+    // Same coverage as with SDL_Point version.
+    //
+    SDL_Point s1 = { (int32_t)p1.X, (int32_t)p1.Y };
+    SDL_Point s2 = { (int32_t)p2.X, (int32_t)p2.Y };
+    SDL_Point s3 = { (int32_t)p3.X, (int32_t)p3.Y };
+
+    double z[3] = { p1.Z, p2.Z, p3.Z };
+
+    RasterizeTriangle(s1, s2, s3, z, colorMask);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::RasterizeTriangle(const SDL_Point& p1,
+                                      const SDL_Point& p2,
+                                      const SDL_Point& p3,
+                                      const double* z,
+                                      uint32_t colorMask)
+  {
+    //
+    // Edge function of the first edge evaluated at the third vertex, which is
+    // twice the signed area of the triangle.
+    //
+    int area = (p2.x - p1.x) * (p3.y - p1.y) - (p2.y - p1.y) * (p3.x - p1.x);
+
+    if (area == 0)
+    {
+      //
+      // Degenerate triangle has nothing to depth test, but without depth it
+      // was always drawn as a line by point inside triangle test, so keep it
+      // that way.
+      //
+      if (z == nullptr)
+      {
+        RasterizePIT(p1, p2, p3, nullptr, 0, colorMask);
+      }
+
+      return;
+    }
+
+    switch (_rasterizerKind)
+    {
+      case RasterizerKind::PIT:
+        RasterizePIT(p1, p2, p3, z, area, colorMask);
+        break;
+
+      case RasterizerKind::INCREMENTAL:
+        RasterizeIncremental(p1, p2, p3, z, area, colorMask);
+        break;
+
+      //
+      // Integer coordinates are pixel centers here, same as in the other
+      // two.
+      //
+      case RasterizerKind::TILED:
+      {
+        Vec3 v1 = { p1.x + 0.5, p1.y + 0.5, z ? z[0] : 0.0 };
+        Vec3 v2 = { p2.x + 0.5, p2.y + 0.5, z ? z[1] : 0.0 };
+        Vec3 v3 = { p3.x + 0.5, p3.y + 0.5, z ? z[2] : 0.0 };
+
+        if (not RasterizeSubpixel(v1, v2, v3, (z != nullptr), colorMask))
+        {
+          RasterizeIncremental(p1, p2, p3, z, area, colorMask);
+        }
+      }
+      break;
+
+      default:
+        SW3D::Error = EngineError::INVALID_MODE;
+        break;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::RasterizePIT(const SDL_Point& p1,
+                                 const SDL_Point& p2,
+                                 const SDL_Point& p3,
+                                 const double* z,
+                                 int area,
+                                 uint32_t colorMask)
+  {
+    int xMin = std::min( std::min(p1.x, p2.x), p3.x);
+    int yMin = std::min( std::min(p1.y, p2.y), p3.y);
+    int xMax = std::max( std::max(p1.x, p2.x), p3.x);
+    int yMax = std::max( std::max(p1.y, p2.y), p3.y);
+
+    //
+    // Scissor bounding box to the color buffer so that we can write into it
+    // without checking every pixel.
+    //
+    xMin = std::max(xMin, 0);
+    yMin = std::max(yMin, 0);
+    xMax = std::min(xMax, (int)_frameBufferSize - 1);
+    yMax = std::min(yMax, (int)_frameBufferSize - 1);
+
+    uint32_t alpha = (colorMask & _maskA) >> 24;
+    bool opaque = (alpha == 0 or alpha == 0xFF);
+
+    uint32_t color = colorMask | _maskA;
+
+    double invArea = (area != 0) ? 1.0 / (double)area : 0.0;
+
+    for (int x = xMin; x <= xMax; x++)
+    {
+      for (int y = yMin; y <= yMax; y++)
+      {
+        SDL_Point p = { x, y };
+
+        //
+        // This way it works a little bit faster it seems.
+        //
+        int w0 = (p2.x - p1.x) * (p.y - p1.y) - (p2.y - p1.y) * (p.x - p1.x);
+        int w1 = (p3.x - p2.x) * (p.y - p2.y) - (p3.y - p2.y) * (p.x - p2.x);
+        int w2 = (p1.x - p3.x) * (p.y - p3.y) - (p1.y - p3.y) * (p.x - p3.x);
+
+        bool inside = (w0 <= 0 and w1 <= 0 and w2 <= 0)
+                   or (w0 >= 0 and w1 >= 0 and w2 >= 0);
+
+        if (not inside)
+        {
+          continue;
+        }
+
+        if (z != nullptr)
+        {
+          //
+          // Screen space Z after perspective divide is linear in screen
+          // space, so plain barycentric interpolation is correct for it.
+          // Each edge function weights the vertex opposite to its edge.
+          //
+          double depth = (w1 * z[0] + w2 * z[1] + w0 * z[2]) * invArea;
+
+          //
+          // Early Z: hidden fragment costs nothing else.
+          //
+          if (not _depthBuffer.TestAndSet(x, y, depth))
+          {
+            continue;
+          }
+        }
+
+        if (opaque)
+        {
+          _colorBuffer[y * _frameBufferSize + x] = color;
+        }
+        else
+        {
+          PutPixel(x, y, colorMask);
+        }
+      }
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::RasterizeIncremental(const SDL_Point& p1,
+                                         const SDL_Point& p2,
+                                         const SDL_Point& p3,
+                                         const double* z,
+                                         int area,
+                                         uint32_t colorMask)
+  {
+    int xMin = std::min( std::min(p1.x, p2.x), p3.x);
+    int yMin = std::min( std::min(p1.y, p2.y), p3.y);
+    int xMax = std::max( std::max(p1.x, p2.x), p3.x);
+    int yMax = std::max( std::max(p1.y, p2.y), p3.y);
+
+    xMin = std::max(xMin, 0);
+    yMin = std::max(yMin, 0);
+    xMax = std::min(xMax, (int)_frameBufferSize - 1);
+    yMax = std::min(yMax, (int)_frameBufferSize - 1);
+
+    if (xMin > xMax or yMin > yMax)
+    {
+      return;
+    }
+
+    uint32_t alpha = (colorMask & _maskA) >> 24;
+    bool opaque = (alpha == 0 or alpha == 0xFF);
+
+    uint32_t color = colorMask | _maskA;
+
+    //
+    // Edge functions are linear in x and y, so moving one pixel right or one
+    // row down changes each of them by a constant:
+    //
+    // w(x + 1, y) = w(x, y) + A
+    // w(x, y + 1) = w(x, y) + B
+    //
+    // Since all three of them sum up to the (non zero) area, they can't all
+    // be negative at the same time for CW triangle and positive for CCW, so
+    // flipping signs for CW case lets us check only for w >= 0, which is
+    // exactly what the "both signs" test does.
+    //
+    int sign = (area > 0) ? 1 : -1;
+
+    int a0 = sign * (p1.y - p2.y);
+    int b0 = sign * (p2.x - p1.x);
+    int a1 = sign * (p2.y - p3.y);
+    int b1 = sign * (p3.x - p2.x);
+    int a2 = sign * (p3.y - p1.y);
+    int b2 = sign * (p1.x - p3.x);
+
+    int w0Row = sign * ( (p2.x - p1.x) * (yMin - p1.y)
+                       - (p2.y - p1.y) * (xMin - p1.x) );
+    int w1Row = sign * ( (p3.x - p2.x) * (yMin - p2.y)
+                       - (p3.y - p2.y) * (xMin - p2.x) );
+    int w2Row = sign * ( (p1.x - p3.x) * (yMin - p3.y)
+                       - (p1.y - p3.y) * (xMin - p3.x) );
+
+    //
+    // Depth is not stepped like that though: rounding errors would pile up
+    // along the row, so it's evaluated from exact edge functions instead,
+    // which gives bit for bit the same depth as in RasterizePIT() (flipped
+    // signs cancel out).
+    //
+    double invArea = 1.0 / (double)(sign * area);
+
+    for (int y = yMin; y <= yMax; y++)
+    {
+      int w0 = w0Row;
+      int w1 = w1Row;
+      int w2 = w2Row;
+
+      uint32_t* row = &_colorBuffer[y * _frameBufferSize];
+
+      bool wasInside = false;
+
+      for (int x = xMin; x <= xMax; x++)
+      {
+        if ((w0 | w1 | w2) >= 0)
+        {
+          wasInside = true;
+
+          //
+          // Early Z: hidden fragment costs nothing else.
+          //
+          if (z == nullptr
+           or _depthBuffer.TestAndSet(x, y, (w1 * z[0]
+                                           + w2 * z[1]
+                                           + w0 * z[2]) * invArea))
+          {
+            if (opaque)
+            {
+              row[x] = color;
+            }
+            else
+            {
+              PutPixel(x, y, colorMask);
+            }
+          }
+        }
+        else if (wasInside)
+        {
+          //
+          // Triangle is convex, so once we're out we're done with this row.
+          //
+          break;
+        }
+
+        w0 += a0;
+        w1 += a1;
+        w2 += a2;
+      }
+
+      w0Row += b0;
+      w1Row += b1;
+      w2Row += b2;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::SetCullFaceMode(CullFaceMode modeToSet)
+  {
+    _cullFaceMode = modeToSet;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::SetMatrixMode(MatrixMode modeToSet)
+  {
+    _matrixMode = modeToSet;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::SetRenderMode(RenderMode modeToSet)
+  {
+    _renderMode = modeToSet;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::SetShadingMode(ShadingMode modeToSet)
+  {
+    _shadingMode = modeToSet;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::SetTexture(int handle)
+  {
+    _texture = GetSampler(handle);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::SetThreadCount(size_t threadsTotal)
+  {
+    _threadCount = threadsTotal;
+
+    //
+    // Otherwise it will be started during initialization.
+    //
+    if (_workers.Size() != 0)
+    {
+      _workers.Start(_threadCount);
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  size_t DrawWrapper::GetThreadCount() const
+  {
+    return _workers.Size();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::SetRasterizerKind(RasterizerKind kindToSet)
+  {
+    _rasterizerKind = kindToSet;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::ClearDepthBuffer()
+  {
+    _depthBuffer.Clear();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::SetDepthFormat(DepthFormat formatToSet)
+  {
+    _depthBuffer.Init(_frameBufferSize, _frameBufferSize, formatToSet);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::SetDepthTestEnabled(bool enabled)
+  {
+    _depthTestEnabled = enabled;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::PushMatrix()
+  {
+    switch (_matrixMode)
+    {
+      case MatrixMode::PROJECTION:
+      {
+        if (_projectionStackSize < SW3D::Constants::kMatrixStackLimit)
+        {
+          _projectionStack[_projectionStackSize++] = { _projectionMatrix,
+                                                       _projectionMode };
+        }
+        else
+        {
+          SW3D::Error = EngineError::STACK_OVERFLOW;
+        }
+      }
+      break;
+
+      case MatrixMode::MODELVIEW:
+      {
+        if (_modelViewStackSize < SW3D::Constants::kMatrixStackLimit)
+        {
+          _modelViewStack[_modelViewStackSize++] = _modelViewMatrix;
+        }
+        else
+        {
+          SW3D::Error = EngineError::STACK_OVERFLOW;
+        }
+      }
+      break;
+
+      default:
+        SW3D::Error = EngineError::INVALID_MODE;
+        break;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::PopMatrix()
+  {
+    switch (_matrixMode)
+    {
+      case MatrixMode::PROJECTION:
+      {
+        if (_projectionStackSize > 1)
+        {
+          //
+          // After we save current projection matrix with PushMatrix() it's
+          // placed on top of the stack. So after that any changes to projection
+          // will modify current projection matrix. When we're done with it and
+          // want to go back to previous projection, it's *on top* of the stack,
+          // so we need to assign it to the current projection matrix variable
+          // first and pop the stack afterwards.
+          //
+          _projectionStackSize--;
+
+          SetProjectionMatrix(_projectionStack[_projectionStackSize].first);
+
+          _projectionMode = _projectionStack[_projectionStackSize].second;
+        }
+        else
+        {
+          SW3D::Error = EngineError::STACK_UNDERFLOW;
+        }
+      }
+      break;
+
+      case MatrixMode::MODELVIEW:
+      {
+        //
+        // Both stacks contain identity matrix from the start, but because
+        // identity modelview matrix corresponds to "no change" it doesn't
+        // matter what order to reassign modelview matrix variable is used, but
+        // for consistency's sake let's rewrite it as with projection matrix
+        // case.
+        //
+        if (_modelViewStackSize > 1)
+        {
+          _modelViewStackSize--;
+
+          SetModelViewMatrix(_modelViewStack[_modelViewStackSize]);
+        }
+        else
+        {
+          SW3D::Error = EngineError::STACK_UNDERFLOW;
+        }
+      }
+      break;
+
+      default:
+        SW3D::Error = EngineError::INVALID_MODE;
+        break;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  SDL_Renderer* DrawWrapper::GetRenderer() const
+  {
+    return _renderer;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const double& DrawWrapper::DeltaTime() const
+  {
+    return _deltaTime;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const double& DrawWrapper::DrawTime() const
+  {
+    return _drawTime;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const size_t& DrawWrapper::FrameBufferSize() const
+  {
+    return _frameBufferSize;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const size_t& DrawWrapper::DrawCalls() const
+  {
+    return _drawCalls;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const std::vector<uint32_t>& DrawWrapper::GetColorBuffer() const
+  {
+    return _colorBuffer;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const DepthBuffer& DrawWrapper::GetDepthBuffer() const
+  {
+    return _depthBuffer;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool DrawWrapper::IsHeadless() const
+  {
+    return _headless;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::SetWeakPerspective()
+  {
+    SetProjectionMatrix(Matrix4::WeakPerspective());
+    _projectionMode = ProjectionMode::WEAK_PERSPECTIVE;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::SetPerspective(double fov,
+                                   double aspectRatio,
+                                   double zNear,
+                                   double zFar)
+  {
+    SetProjectionMatrix(Matrix4::Perspective(fov,
+                                             aspectRatio,
+                                             zNear,
+                                             zFar));
+    _projectionMode = ProjectionMode::PERSPECTIVE;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::SetOrthographic(double left, double right,
+                                    double top, double bottom,
+                                    double near, double far)
+  {
+    SetProjectionMatrix(Matrix4::Orthographic(left, right,
+                                              top, bottom,
+                                              near, far));
+    _projectionMode = ProjectionMode::ORTHOGRAPHIC;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const Matrix4& DrawWrapper::GetModelViewMatrix() const
+  {
+    return _modelViewMatrix;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const Matrix4& DrawWrapper::GetProjectionMatrix() const
+  {
+    return _projectionMatrix;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::SetModelViewMatrix(const Matrix4& m)
+  {
+    _modelViewMatrix = m;
+    _transformDirty  = true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::SetProjectionMatrix(const Matrix4& m)
+  {
+    _projectionMatrix = m;
+    _transformDirty   = true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::ApplyShading(const Vec3& lookVector,
+                                 Triangle& face,
+                                 const Vec3& viewDirection) const
+  {
+    //
+    // Vec3::Normalize() reports zero length via global Error, which can't
+    // be touched from worker threads, so it's done here. Degenerate
+    // triangle simply stays unlit.
+    //
+    auto normalize = [](Vec3& v)
+    {
+      double l = v.Length();
+
+      if (l != 0.0)
+      {
+        v.X /= l;
+        v.Y /= l;
+        v.Z /= l;
+      }
+    };
+
+    Vec3 v1 = face.Points[1].Position - face.Points[0].Position;
+    Vec3 v2 = face.Points[2].Position - face.Points[0].Position;
+    Vec3 n  = SW3D::CrossProduct(v1, v2);
+
+    //
+    // For backface culling this is not necessary, but for shading it is.
+    //
+    normalize(n);
+
+    Vec3 fv = (_projectionMode == ProjectionMode::ORTHOGRAPHIC)
+              ? viewDirection
+              : face.Points[0].Position - lookVector;
+
+    normalize(fv);
+
+    double dp = SW3D::DotProduct(fv, n);
+
+    if (dp < 0.0)
+    {
+      dp = -dp;
+    }
+
+    uint8_t grayscalePart = (uint8_t)(255.0 * dp);
+
+    if (face.ShadingMode_ == ShadingMode::NONE)
+    {
+      grayscalePart = 255;
+    }
+
+    //
+    // Everything is one color for now.
+    //
+    face.Points[0].Color[0] = grayscalePart;
+    face.Points[0].Color[1] = grayscalePart;
+    face.Points[0].Color[2] = grayscalePart;
+    face.Points[0].Color[3] = 255;
+
+    face.Points[1].Color[0] = grayscalePart;
+    face.Points[1].Color[1] = grayscalePart;
+    face.Points[1].Color[2] = grayscalePart;
+    face.Points[1].Color[3] = 255;
+
+    face.Points[2].Color[0] = grayscalePart;
+    face.Points[2].Color[1] = grayscalePart;
+    face.Points[2].Color[2] = grayscalePart;
+    face.Points[2].Color[3] = 255;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::ShouldCullFace(const Vec3& lookVector,
+                                   Triangle& face,
+                                   const Vec3& viewDirection) const
+  {
+    Vec3 v1 = face.Points[1].Position - face.Points[0].Position;
+    Vec3 v2 = face.Points[2].Position - face.Points[0].Position;
+    Vec3 n  = SW3D::CrossProduct(v1, v2);
+
+    //
+    // Because in perspective projection we have vanishing point, in order to
+    // properly cull faces we must compute dot product between face normal and
+    // direction vector from camera to that face.
+    // But in orthographic projection there is no vanishing point (or one can
+    // think that in this type of projection camera is moved at infinity so all
+    // vectors from camera to object are parallel), so our vector from camera to
+    // object actually doesn't make sense and thus produces wrong result.
+    // So in order to cull faces properly for orthographic projection we must
+    // use camera's direction vector towards the object.
+    //
+    // Can be any point of a triangle since they're all lying on the same plane.
+    //
+    Vec3 fv = (_projectionMode == ProjectionMode::ORTHOGRAPHIC)
+              ? viewDirection
+              : face.Points[0].Position - lookVector;
+
+    double dp = SW3D::DotProduct(fv, n);
+
+    face.CullFlag = (_cullFaceMode == CullFaceMode::BACK)
+                    ? (dp >= 0.0)
+                    : (dp < 0.0);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::UpdateTransform()
+  {
+    if (not _transformDirty)
+    {
+      return;
+    }
+
+    _mvpMatrix = _modelViewMatrix * _projectionMatrix;
+
+    //
+    // Eye in object space is the point modelview takes to the origin, and it
+    // looks along whatever modelview takes to Vec3::In(). So translation and
+    // Vec3::In() go back through inverse of modelview's 3x3 part, which is
+    // the adjugate over determinant, since it may scale as well as rotate.
+    //
+    const Matrix4& m = _modelViewMatrix;
+
+    double inv[3][3] =
+    {
+      {
+        m[1][1] * m[2][2] - m[1][2] * m[2][1],
+        m[0][2] * m[2][1] - m[0][1] * m[2][2],
+        m[0][1] * m[1][2] - m[0][2] * m[1][1]
+      },
+      {
+        m[1][2] * m[2][0] - m[1][0] * m[2][2],
+        m[0][0] * m[2][2] - m[0][2] * m[2][0],
+        m[0][2] * m[1][0] - m[0][0] * m[1][2]
+      },
+      {
+        m[1][0] * m[2][1] - m[1][1] * m[2][0],
+        m[0][1] * m[2][0] - m[0][0] * m[2][1],
+        m[0][0] * m[1][1] - m[0][1] * m[1][0]
+      }
+    };
+
+    double det = m[0][0] * inv[0][0]
+               + m[0][1] * inv[1][0]
+               + m[0][2] * inv[2][0];
+
+    //
+    // Everything is squashed flat then, so nothing is going to be visible
+    // anyway.
+    //
+    double invDet = (det != 0.0) ? (1.0 / det) : 0.0;
+
+    auto toObject = [&inv, invDet](const Vec3& v)
+    {
+      return Vec3
+      {
+        (v.X * inv[0][0] + v.Y * inv[1][0] + v.Z * inv[2][0]) * invDet,
+        (v.X * inv[0][1] + v.Y * inv[1][1] + v.Z * inv[2][1]) * invDet,
+        (v.X * inv[0][2] + v.Y * inv[1][2] + v.Z * inv[2][2]) * invDet
+      };
+    };
+
+    Vec3 t = { m[3][0], m[3][1], m[3][2] };
+
+    _eyePosition  = toObject(t) * -1.0;
+    _eyeDirection = toObject(Vec3::In());
+
+    if (det != 0.0)
+    {
+      _eyeDirection.Normalize();
+    }
+
+    _modelViewScale = 0.0;
+
+    for (uint32_t i = 0; i < 3; i++)
+    {
+      double axis = std::sqrt(m[i][0] * m[i][0]
+                            + m[i][1] * m[i][1]
+                            + m[i][2] * m[i][2]);
+
+      _modelViewScale = std::max(_modelViewScale, axis);
+    }
+
+    //
+    // Clip space plane dotted with v * MVP is the same as some other plane
+    // dotted with v itself, which gives frustum in object space. Planes are
+    // normalized so that distances to them are actual distances.
+    //
+    ClipPlane planes[6] =
+    {
+      kViewportPlanes[0],
+      kViewportPlanes[1],
+      kViewportPlanes[2],
+      kViewportPlanes[3]
+    };
+
+    _frustum.PlanesCount = GetDepthPlanes(planes[4], planes[5]) ? 6 : 5;
+
+    for (size_t i = 0; i < _frustum.PlanesCount; i++)
+    {
+      const ClipPlane& c = planes[i];
+
+      auto row = [&c, this](uint32_t r)
+      {
+        return c.X * _mvpMatrix[r][0]
+             + c.Y * _mvpMatrix[r][1]
+             + c.Z * _mvpMatrix[r][2]
+             + c.W * _mvpMatrix[r][3];
+      };
+
+      Vec4 p = { row(0), row(1), row(2), row(3) + c.D };
+
+      double l = std::sqrt(p.X * p.X + p.Y * p.Y + p.Z * p.Z);
+
+      if (l != 0.0)
+      {
+        p.X /= l;
+        p.Y /= l;
+        p.Z /= l;
+        p.W /= l;
+      }
+
+      _frustum.Planes[i] = p;
+    }
+
+    _transformDirty = false;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const Matrix4& DrawWrapper::GetModelViewProjection()
+  {
+    UpdateTransform();
+    return _mvpMatrix;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool DrawWrapper::ShadeAndCull(Triangle& tri) const
+  {
+    tri.ShadingMode_  = _shadingMode;
+    tri.RenderMode_   = _renderMode;
+    tri.DepthTestFlag = _depthTestEnabled;
+
+    ApplyShading(_eyePosition, tri, _eyeDirection);
+
+    if (_cullFaceMode != CullFaceMode::NONE)
+    {
+      //
+      // Smart people say backface culling should be performed in world space.
+      // Object space is even better, since nothing has to be transformed.
+      //
+      ShouldCullFace(_eyePosition, tri, _eyeDirection);
+
+      //
+      // Apply projection only if triangle will be visible.
+      //
+      return (not tri.CullFlag);
+    }
+
+    //
+    // Not doing shit.
+    //
+    tri.CullFlag = false;
+
+    return true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::ProcessTriangle(const Triangle& t,
+                                    std::vector<PipelineItem>& out,
+                                    EngineError& error) const
+  {
+    Triangle tri;
+
+    for (size_t i = 0; i < 3; i++)
+    {
+      tri.Points[i].Position = t.Points[i].Position;
+      tri.Points[i].UV       = t.Points[i].UV;
+    }
+
+    if (ShadeAndCull(tri))
+    {
+      ProjectAndClip(tri, out, error);
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::Enqueue(const Triangle& t)
+  {
+    UpdateTransform();
+
+    EngineError error = EngineError::OK;
+
+    ProcessTriangle(t, _pipeline, error);
+
+    if (error != EngineError::OK)
+    {
+      SW3D::Error = error;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::EnqueueBatch(const std::vector<Triangle>& triangles)
+  {
+    UpdateTransform();
+
+    ProcessGeometry(triangles.size(),
+    [this, &triangles](size_t begin,
+                       size_t end,
+                       std::vector<PipelineItem>& out,
+                       EngineError& error)
+    {
+      for (size_t i = begin; i < end; i++)
+      {
+        ProcessTriangle(triangles[i], out, error);
+      }
+    });
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::ProcessGeometry(size_t count, const GeometryJob& job)
+  {
+    size_t chunks = (count + kGeometryChunkSize - 1) / kGeometryChunkSize;
+
+    if (chunks < 2 or _workers.Size() < 2)
+    {
+      EngineError error = EngineError::OK;
+
+      job(0, count, _pipeline, error);
+
+      if (error != EngineError::OK)
+      {
+        SW3D::Error = error;
+      }
+
+      return;
+    }
+
+    if (_geometryQueues.size() < chunks)
+    {
+      _geometryQueues.resize(chunks);
+    }
+
+    _workers.ParallelFor(chunks, [this, count, &job](size_t chunk)
+    {
+      GeometryQueue& q = _geometryQueues[chunk];
+
+      q.Items.clear();
+      q.Error = EngineError::OK;
+
+      size_t begin = chunk * kGeometryChunkSize;
+      size_t end   = std::min(begin + kGeometryChunkSize, count);
+
+      job(begin, end, q.Items, q.Error);
+    });
+
+    //
+    // Chunks are consecutive ranges, so appending them one after another
+    // gives the same order as if everything was done on this thread.
+    //
+    for (size_t i = 0; i < chunks; i++)
+    {
+      const GeometryQueue& q = _geometryQueues[i];
+
+      _pipeline.insert(_pipeline.end(), q.Items.begin(), q.Items.end());
+
+      if (q.Error != EngineError::OK)
+      {
+        SW3D::Error = q.Error;
+      }
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const Vec4& DrawWrapper::GetTransformedVertex(int32_t index,
+                                                const Vec3& position)
+  {
+    std::atomic<uint32_t>& stamp = _postTransformStamps[index];
+
+    if (stamp.load(std::memory_order_relaxed) != _transformStamp
+     and stamp.exchange(_transformStamp, std::memory_order_relaxed) != _transformStamp)
+    {
+      _postTransform[index] = _mvpMatrix * Vec4(position.X, position.Y, position.Z);
+    }
+
+    return _postTransform[index];
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::DrawIndexed(const ModelLoader::Scene& scene,
+                                const ModelLoader::Scene::Object& obj)
+  {
+    const bool indexed = not obj.IndexBuffer.empty();
+
+    //
+    // Stays full detail unless it's indexed and far away.
+    //
+    const size_t lod = indexed ? SelectLod(obj) : 0;
+
+    const std::vector<uint32_t>& indices = (lod == 0) ? obj.IndexBuffer
+                                                      : obj.Lods[lod - 1];
+
+    const size_t verticesCount = indexed
+                               ? obj.VertexBuffer.size()
+                               : scene.Vertices.size();
+
+    if (_postTransform.size() < verticesCount)
+    {
+      _postTransform.resize(verticesCount);
+
+      //
+      // Atomics can't be moved around, so it's a new array every time.
+      //
+      _postTransformStamps = std::vector<std::atomic<uint32_t>>(verticesCount);
+
+      for (std::atomic<uint32_t>& stamp : _postTransformStamps)
+      {
+        stamp.store(0, std::memory_order_relaxed);
+      }
+
+      _transformStamp = 0;
+    }
+
+    UpdateTransform();
+
+    if (not IsInFrustum(obj.Bounds, obj.Sphere))
+    {
+      return;
+    }
+
+    //
+    // Matrices may change between calls, so everything transformed before
+    // is considered stale.
+    //
+    _transformStamp++;
+
+    if (_transformStamp == 0)
+    {
+      for (std::atomic<uint32_t>& stamp : _postTransformStamps)
+      {
+        stamp.store(0, std::memory_order_relaxed);
+      }
+
+      _transformStamp = 1;
+    }
+
+    //
+    // Index of face's vertex in whatever is transformed, -1 if there's no
+    // such vertex.
+    //
+    auto vertexIndex = [&obj, &indices, indexed, verticesCount](size_t face,
+                                                                size_t i)
+    {
+      int32_t index = indexed
+                    ? (int32_t)indices[face * 3 + i]
+                    : obj.Faces[face].Indices[i][0];
+
+      return (index >= 0 and (size_t)index < verticesCount) ? index : -1;
+    };
+
+    auto position = [&scene, &obj, indexed](int32_t index) -> const Vec3&
+    {
+      return indexed ? obj.VertexBuffer[index].Position : scene.Vertices[index];
+    };
+
+    const size_t facesCount = indexed
+                            ? indices.size() / 3
+                            : obj.Faces.size();
+
+    //
+    // Threads only read transformed vertices when assembling triangles, so
+    // in parallel case all of them have to be transformed beforehand.
+    // Otherwise somebody could read a vertex that's still being transformed
+    // by somebody else.
+    //
+    if (facesCount > kGeometryChunkSize and _workers.Size() > 1)
+    {
+      size_t chunks = (facesCount + kGeometryChunkSize - 1) / kGeometryChunkSize;
+
+      _workers.ParallelFor(chunks,
+      [this, &vertexIndex, &position, facesCount](size_t chunk)
+      {
+        size_t begin = chunk * kGeometryChunkSize;
+        size_t end   = std::min(begin + kGeometryChunkSize, facesCount);
+
+        for (size_t i = begin; i < end; i++)
+        {
+          for (size_t j = 0; j < 3; j++)
+          {
+            int32_t vertexInd = vertexIndex(i, j);
+
+            if (vertexInd != -1)
+            {
+              GetTransformedVertex(vertexInd, position(vertexInd));
+            }
+          }
+        }
+      });
+    }
+
+    ProcessGeometry(facesCount,
+    [this, &scene, &obj, &vertexIndex, indexed](size_t begin,
+                                                size_t end,
+                                                std::vector<PipelineItem>& out,
+                                                EngineError& error)
+    {
+      Triangle tri;
+
+      ClipVertex polygon[kMaxClipVertices];
+
+      for (size_t f = begin; f < end; f++)
+      {
+        bool valid = true;
+
+        for (size_t i = 0; i < 3; i++)
+        {
+          int32_t vertexInd = vertexIndex(f, i);
+
+          if (vertexInd == -1)
+          {
+            valid = false;
+            break;
+          }
+
+          Vertex& v = tri.Points[i];
+
+          if (indexed)
+          {
+            v = obj.VertexBuffer[vertexInd];
+          }
+          else
+          {
+            int32_t textureInd = obj.Faces[f].Indices[i][1];
+            int32_t normalInd  = obj.Faces[f].Indices[i][2];
+
+            v.Position = scene.Vertices[vertexInd];
+
+            v.UV = (textureInd >= 0 and (size_t)textureInd < scene.UV.size())
+                   ? scene.UV[textureInd]
+                   : Vec2();
+
+            v.Normal = (normalInd >= 0 and (size_t)normalInd < scene.Normals.size())
+                       ? scene.Normals[normalInd]
+                       : Vec3();
+          }
+
+          polygon[i].Position = GetTransformedVertex(vertexInd, v.Position);
+          polygon[i].Normal   = v.Normal;
+          polygon[i].UV       = v.UV;
+        }
+
+        if (valid and ShadeAndCull(tri))
+        {
+          ClipAndSubmit(tri, polygon, out, error);
+        }
+      }
+    });
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool DrawWrapper::GetDepthPlanes(ClipPlane& nearPlane,
+                                   ClipPlane& farPlane) const
+  {
+    //
+    // Near and far planes depend on what range projection maps z into.
+    // Weak perspective doesn't have any, so there we just keep away from
+    // w = 0 (and from what's behind the camera).
+    //
+    nearPlane = { 0.0, 0.0, 1.0, 0.0, 0.0 };
+    farPlane  = { 0.0, 0.0, -1.0, 1.0, 0.0 };
+
+    switch (_projectionMode)
+    {
+      case ProjectionMode::ORTHOGRAPHIC:
+        nearPlane = { 0.0, 0.0, 1.0, 1.0, 0.0 };
+        return true;
+
+      case ProjectionMode::WEAK_PERSPECTIVE:
+        nearPlane = { 0.0, 0.0, 0.0, 1.0, -1e-6 };
+        return false;
+
+      default:
+        return true;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool DrawWrapper::IsInFrustum(const AABB& box, const BoundingSphere& sphere)
+  {
+    //
+    // Nothing's known about it, so let clipping deal with it.
+    //
+    if (box.IsEmpty())
+    {
+      return true;
+    }
+
+    UpdateTransform();
+
+    if (sphere.Radius >= 0.0
+     and _frustum.Test(sphere) == FrustumTest::OUTSIDE)
+    {
+      return false;
+    }
+
+    return (_frustum.Test(box) != FrustumTest::OUTSIDE);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const Frustum& DrawWrapper::GetFrustum()
+  {
+    UpdateTransform();
+    return _frustum;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::SetLodThreshold(double pixels)
+  {
+    _lodThreshold = pixels;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  size_t DrawWrapper::SelectLod(const ModelLoader::Scene::Object& obj)
+  {
+    const BoundingSphere& sphere = obj.Sphere;
+
+    if (_lodThreshold <= 0.0 or obj.Lods.empty() or sphere.Radius < 0.0)
+    {
+      return 0;
+    }
+
+    UpdateTransform();
+
+    const Vec3& c = sphere.Center;
+
+    Vec4 clip = _mvpMatrix * Vec4(c.X, c.Y, c.Z);
+
+    //
+    // Radius is taken to view space with the largest scale of modelview,
+    // after that projection alone decides how big it gets on screen.
+    // Camera inside of (or too close to) the sphere means it's big.
+    //
+    double radius = sphere.Radius * _modelViewScale;
+
+    double w = clip.W;
+
+    if (_projectionMode != ProjectionMode::ORTHOGRAPHIC and w <= radius)
+    {
+      return 0;
+    }
+
+    double scale = std::max(std::abs(_projectionMatrix[0][0]),
+                            std::abs(_projectionMatrix[1][1]));
+
+    //
+    // Normalized device coordinates span two units across frame buffer.
+    //
+    double size = (radius * scale / std::abs(w)) * _frameBufferSize;
+
+    size_t lod = 0;
+
+    double threshold = _lodThreshold;
+
+    while (lod < obj.Lods.size() and size < threshold)
+    {
+      threshold *= 0.5;
+      lod++;
+    }
+
+    return lod;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  size_t DrawWrapper::ClipPolygon(const ClipVertex* in,
+                                  size_t count,
+                                  const ClipPlane& plane,
+                                  ClipVertex* out) const
+  {
+    auto distance = [&plane](const Vec4& v)
+    {
+      return plane.X * v.X
+           + plane.Y * v.Y
+           + plane.Z * v.Z
+           + plane.W * v.W
+           + plane.D;
+    };
+
+    size_t written = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+      const ClipVertex& a = in[i];
+      const ClipVertex& b = in[(i + 1) % count];
+
+      double da = distance(a.Position);
+      double db = distance(b.Position);
+
+      if (da >= 0.0)
+      {
+        out[written++] = a;
+      }
+
+      //
+      // Edge crosses the plane, add intersection point.
+      //
+      if ((da >= 0.0) != (db >= 0.0))
+      {
+        double k = da / (da - db);
+
+        auto lerp = [k](double from, double to)
+        {
+          return from + (to - from) * k;
+        };
+
+        ClipVertex& v = out[written++];
+
+        v.Position.X = lerp(a.Position.X, b.Position.X);
+        v.Position.Y = lerp(a.Position.Y, b.Position.Y);
+        v.Position.Z = lerp(a.Position.Z, b.Position.Z);
+        v.Position.W = lerp(a.Position.W, b.Position.W);
+
+        v.Normal.X = lerp(a.Normal.X, b.Normal.X);
+        v.Normal.Y = lerp(a.Normal.Y, b.Normal.Y);
+        v.Normal.Z = lerp(a.Normal.Z, b.Normal.Z);
+
+        v.UV.X = lerp(a.UV.X, b.UV.X);
+        v.UV.Y = lerp(a.UV.Y, b.UV.Y);
+      }
+    }
+
+    return written;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::ProjectAndClip(const Triangle& tri,
+                                   std::vector<PipelineItem>& out,
+                                   EngineError& error) const
+  {
+    ClipVertex polygon[kMaxClipVertices];
+
+    for (size_t i = 0; i < 3; i++)
+    {
+      const Vertex& v = tri.Points[i];
+
+      polygon[i].Position = _mvpMatrix * Vec4(v.Position.X,
+                                              v.Position.Y,
+                                              v.Position.Z);
+      polygon[i].Normal = v.Normal;
+      polygon[i].UV     = v.UV;
+    }
+
+    ClipAndSubmit(tri, polygon, out, error);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::ClipAndSubmit(const Triangle& tri,
+                                  ClipVertex* polygon,
+                                  std::vector<PipelineItem>& out,
+                                  EngineError& error) const
+  {
+    ClipVertex clipped[kMaxClipVertices];
+
+    ClipPlane nearPlane;
+    ClipPlane farPlane;
+
+    bool hasFarPlane = GetDepthPlanes(nearPlane, farPlane);
+
+    //
+    // Guard band is chosen so that anything inside of it still fits into
+    // what rasterizer can handle (see kMaxScreenCoord). Triangles that are
+    // completely inside are left as is and just get scissored to the frame
+    // buffer during rasterization.
+    //
+    double g = kMaxScreenCoord / (double)_frameBufferSize;
+
+    const ClipPlane guardBand[4] =
+    {
+      { -1.0,  0.0, 0.0, g, 0.0 },
+      {  1.0,  0.0, 0.0, g, 0.0 },
+      {  0.0, -1.0, 0.0, g, 0.0 },
+      {  0.0,  1.0, 0.0, g, 0.0 }
+    };
+
+    auto outsideMask = [&polygon](const ClipPlane& plane)
+    {
+      int mask = 0;
+
+      for (size_t i = 0; i < 3; i++)
+      {
+        const Vec4& v = polygon[i].Position;
+
+        double d = plane.X * v.X
+                 + plane.Y * v.Y
+                 + plane.Z * v.Z
+                 + plane.W * v.W
+                 + plane.D;
+
+        //
+        // Negated so that NaN is considered outside.
+        //
+        if (not (d >= 0.0))
+        {
+          mask |= (1 << i);
+        }
+      }
+
+      return mask;
+    };
+
+    //
+    // Completely on the wrong side of any of the view planes means it's not
+    // visible at all. Points behind the camera can project anywhere, so it's
+    // only safe to test against viewport after near plane has been checked.
+    //
+    int nearMask = outsideMask(nearPlane);
+    int farMask  = hasFarPlane ? outsideMask(farPlane) : 0;
+
+    if (nearMask == 0x7 or farMask == 0x7)
+    {
+      return;
+    }
+
+    if (nearMask == 0)
+    {
+      for (const ClipPlane& plane : kViewportPlanes)
+      {
+        if (outsideMask(plane) == 0x7)
+        {
+          return;
+        }
+      }
+    }
+
+    ClipPlane planes[6];
+    size_t planesCount = 0;
+
+    if (nearMask != 0)
     {
-      SDL_Log("Canvas size is zero - increase quality!");
-      return false;
+      planes[planesCount++] = nearPlane;
     }
 
-    _windowWidth  = windowWidth;
-    _windowHeight = windowHeight;
+    if (farMask != 0)
+    {
+      planes[planesCount++] = farPlane;
+    }
 
-    SDL_DisplayMode dm;
-    if (SDL_GetCurrentDisplayMode(0, &dm) < 0)
+    for (const ClipPlane& plane : guardBand)
     {
-      SDL_Log("SDL_GetCurrentDisplayMode() error: %s", SDL_GetError());
-      return false;
+      if (outsideMask(plane) != 0)
+      {
+        planes[planesCount++] = plane;
+      }
     }
 
-    _window = SDL_CreateWindow(_windowName.data(),
-                               dm.w / 2 - _windowWidth / 2,
-                               dm.h / 2 - _windowHeight / 2,
-                               _windowWidth,
-                               _windowHeight,
-                               SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+    size_t count = 3;
 
-    if (_window == nullptr)
+    ClipVertex* src = polygon;
+    ClipVertex* dst = clipped;
+
+    for (size_t i = 0; i < planesCount and count >= 3; i++)
     {
-      SDL_Log("SDL_CreateWindow() error: %s", SDL_GetError());
-      return false;
+      count = ClipPolygon(src, count, planes[i], dst);
+      std::swap(src, dst);
     }
 
-    const char* driverHint = "opengl";
-
-    SDL_bool ok = SDL_SetHint(SDL_HINT_RENDER_DRIVER, driverHint);
-    if (ok == SDL_FALSE)
+    if (count < 3)
     {
-      SDL_Log("Hint value '%s' could not be set! (SDL_HINT_RENDER_DRIVER)",
-              driverHint);
+      return;
     }
 
     //
-    // Old versions of SDL2 don't support subpixel drawing hints.
-    // Out of the box subpixel precision line drawing works only with this
-    // hint set to "2" or "3" on Windows. It is unclear which one is better,
-    // but I decided to use "3". Not sure if it works at all for subpixel points
-    // drawing since test project (cr) showed no difference.
-    // Maybe disable it eventually or implement custom subpixel drawing somehow.
+    // Back to Cartesian and into the screen.
     //
-#if (SDL_MAJOR_VERSION == 2 and SDL_MINOR_VERSION == 0 and SDL_PATCHLEVEL >= 20) \
- or (SDL_MAJOR_VERSION >= 2 and SDL_MINOR_VERSION > 0)
-    const char* lineHint = "3";
+    PipelineItem::Point screen[kMaxClipVertices];
 
-    ok = SDL_SetHint(SDL_HINT_RENDER_LINE_METHOD, lineHint);
-    if (ok == SDL_FALSE)
-    {
-      SDL_Log("Hint value '%s' couldn't be set! (SDL_HINT_RENDER_LINE_METHOD)",
-              lineHint);
-    }
-#endif
+    //
+    // Orthographic projection leaves z in [-1 ; 1] (see GetDepthPlanes()),
+    // perspective one in [0 ; 1], and UNORM depth buffer can only hold the
+    // latter.
+    //
+    bool remapDepth = (_projectionMode == ProjectionMode::ORTHOGRAPHIC);
 
-    _renderer = SDL_CreateRenderer(_window, -1, SDL_RENDERER_ACCELERATED);
-    if (_renderer == nullptr)
+    for (size_t i = 0; i < count; i++)
     {
-      SDL_Log("Failed to create renderer with SDL_RENDERER_ACCELERATED"
-              " - falling back to software");
+      const Vec4& p = src[i].Position;
 
-      _renderer = SDL_CreateRenderer(_window, -1, SDL_RENDERER_SOFTWARE);
-      if (_renderer == nullptr)
+      if (p.W == 0.0)
       {
-        SDL_Log("Failed to create renderer: %s", SDL_GetError());
-        return false;
+        error = EngineError::DIVISION_BY_ZERO;
+        return;
       }
-    }
-
-    _framebuffer = SDL_CreateTexture(_renderer,
-                                     SDL_PIXELFORMAT_RGBA32,
-                                     SDL_TEXTUREACCESS_TARGET,
-                                     _frameBufferSize,
-                                     _frameBufferSize);
-    if (_framebuffer == nullptr)
-    {
-      SDL_Log("Failed to create framebuffer: %s", SDL_GetError());
-      return false;
-    }
 
-    _depthBuffer.resize(_frameBufferSize);
+      double invW = 1.0 / p.W;
 
-    for (size_t i = 0; i < _frameBufferSize; i++)
-    {
-      //
-      // For some reason numeric_limits<double>::max() for double prints 0.
-      // Maybe I'll do it the other way around (z buffer goes from 0 to +inf)
-      // if current implementation works.
-      //
-      _depthBuffer[i].resize(_frameBufferSize,
-                             std::numeric_limits<double>::infinity());
+      screen[i].X    = ( (p.X * invW + 1.0) / 2.0 ) * (double)_frameBufferSize;
+      screen[i].Y    = ( (p.Y * invW + 1.0) / 2.0 ) * (double)_frameBufferSize;
+      screen[i].Z    = remapDepth ? (p.Z * invW + 1.0) / 2.0 : p.Z * invW;
+      screen[i].InvW = invW;
+      screen[i].U    = src[i].UV.X;
+      screen[i].V    = src[i].UV.Y;
     }
 
-    _aspectRatio = (double)_windowHeight / (double)_windowWidth;
-
-    SDL_SetRenderDrawColor(_renderer, 0, 0, 0, 255);
+    PipelineItem res;
 
-    _projectionMatrix.SetIdentity();
-    _modelViewMatrix.SetIdentity();
+    res.ColorMask     = Array2Mask(tri.Points[0].Color);
+    res.Texture       = _texture;
+    res.RenderMode_   = tri.RenderMode_;
+    res.DepthTestFlag = tri.DepthTestFlag;
 
     //
-    // Both stacks contain identity matrices OpenGL style, and since identity
-    // matrix is basically orthographic projection save corresponding mode as
-    // well.
+    // Clipped polygon is convex, so fan will do.
     //
-    _projectionStack.push({ _projectionMatrix, ProjectionMode::ORTHOGRAPHIC });
-    _modelViewStack.push(_modelViewMatrix);
-
-    _initialized = true;
-
-    PostInit();
+    for (size_t i = 1; i + 1 < count; i++)
+    {
+      res.Points[0] = screen[0];
+      res.Points[1] = screen[i];
+      res.Points[2] = screen[i + 1];
 
-    return true;
+      out.push_back(res);
+    }
   }
 
   // ---------------------------------------------------------------------------
 
-  void DrawWrapper::Run(bool debugMode)
+  void DrawWrapper::CommenceDraw()
   {
-    INIT_CHECK();
-
-    SDL_Event evt;
-
-    Clock::time_point measureStart;
-    Clock::time_point measureEnd;
+    static Clock::time_point tp;
 
-    ns dt = ns{0};
+    tp = Clock::now();
 
-    while (_running)
+    for (const PipelineItem& tri : _pipeline)
     {
-      _drawCalls = 0;
-
-      measureStart = Clock::now();
-      measureEnd = measureStart;
-
-      while (SDL_PollEvent(&evt))
-      {
-        HandleEvent(evt);
-      }
-
-      SDL_SetRenderTarget(_renderer, _framebuffer);
-      SDL_RenderClear(_renderer);
+      Vec3 p[3];
 
-      if (debugMode)
+      for (size_t i = 0; i < 3; i++)
       {
-        DrawGrid();
+        p[i] = { tri.Points[i].X, tri.Points[i].Y, tri.Points[i].Z };
       }
 
-      DrawToFrameBuffer();
+      bool fill = (tri.RenderMode_ != RenderMode::WIREFRAME);
 
-      SDL_SetRenderTarget(_renderer, nullptr);
-      SDL_RenderClear(_renderer);
+      bool tiled = (_rasterizerKind == RasterizerKind::TILED
+                 or tri.Texture != nullptr);
 
-      int ok = SDL_RenderCopy(_renderer, _framebuffer, nullptr, nullptr);
-      if (ok < 0)
+      if (tiled
+       and fill
+       and BinTriangle(tri))
       {
-        SDL_Log("%s", SDL_GetError());
-      }
-
-      DrawToScreen();
-
-      SDL_RenderPresent(_renderer);
+        if (tri.RenderMode_ == RenderMode::MIXED)
+        {
+          //
+          // Lines are not binned, so everything that came before them has to
+          // hit the buffers first to keep drawing order.
+          //
+          FlushBins();
 
-      _fps++;
+          DrawTriangle(p[0], p[1], p[2], 0, RenderMode::WIREFRAME);
+        }
+      }
+      else if (tri.Texture != nullptr and fill)
+      {
+        //
+        // Nothing else can texture it, and what tiled rasterizer refuses is
+        // either zero area after snapping (so no pixels to fill) or garbage
+        // coordinates. Drawing it flat would only leave untextured specks.
+        //
+        if (tri.RenderMode_ == RenderMode::MIXED)
+        {
+          FlushBins();
 
-      measureEnd = Clock::now();
-      dt = measureEnd - measureStart;
+          DrawTriangle(p[0], p[1], p[2], 0, RenderMode::WIREFRAME);
+        }
+      }
+      else if (tri.DepthTestFlag and fill)
+      {
+        FlushBins();
 
-      _deltaTime = std::chrono::duration<double>(dt).count();
-      _dtAcc += _deltaTime;
+        FillTriangle(p[0], p[1], p[2], tri.ColorMask);
 
-      if (_dtAcc > 1.0)
+        if (tri.RenderMode_ == RenderMode::MIXED)
+        {
+          DrawTriangle(p[0], p[1], p[2], 0, RenderMode::WIREFRAME);
+        }
+      }
+      else
       {
-        static char buf[128];
-
-        ::snprintf(buf, sizeof(buf), "FPS: %u", _fps);
-        SDL_SetWindowTitle(_window, buf);
+        FlushBins();
 
-        _dtAcc = 0.0;
-        _fps = 0;
+        DrawTriangle(p[0], p[1], p[2], tri.ColorMask, tri.RenderMode_);
       }
     }
 
-    SDL_Log("Goodbye!");
+    //
+    // Capacity stays for the next frame.
+    //
+    _pipeline.clear();
+
+    FlushBins();
+
+    _drawTime = std::chrono::duration<double>(Clock::now() - tp ).count();
   }
 
   // ---------------------------------------------------------------------------
 
-  int DrawWrapper::LoadTexture(const std::string& fname)
+  bool DrawWrapper::SetupTriangle(const Vec3& p1,
+                                  const Vec3& p2,
+                                  const Vec3& p3,
+                                  bool depthTest,
+                                  uint32_t colorMask,
+                                  TriangleSetup& ts,
+                                  const PipelineItem* textured)
   {
-    if (_textureHandleByFname[fname] == 1)
+    const Vec3* v[3] = { &p1, &p2, &p3 };
+
+    const int shift = _subpixelBits;
+    const double scale = (double)(1 << shift);
+
+    int64_t X[3];
+    int64_t Y[3];
+
+    for (int i = 0; i < 3; i++)
     {
-      SDL_Log("Texture '%s' already loaded (handle %d) - reloading",
-              fname.data(), _textureHandleByFname[fname]);
-      FreeTexture(_textureHandleByFname[fname]);
+      //
+      // Negated so that NaN doesn't pass either.
+      //
+      if (not (std::fabs(v[i]->X) <= kMaxScreenCoord
+           and std::fabs(v[i]->Y) <= kMaxScreenCoord))
+      {
+        return false;
+      }
+
+      X[i] = std::llround(v[i]->X * scale);
+      Y[i] = std::llround(v[i]->Y * scale);
     }
 
-    SDL_Surface* surf = SDL_LoadBMP(fname.data());
-    if (surf == nullptr)
+    int64_t area = (X[1] - X[0]) * (Y[2] - Y[0])
+                 - (Y[1] - Y[0]) * (X[2] - X[0]);
+
+    if (area == 0)
     {
-      SDL_Log("SDL_LoadBMP() fail - %s", SDL_GetError());
-      return -1;
+      return false;
     }
 
     //
-    // No transparency for now.
+    // Pixel (x, y) is sampled at ((x << shift) + half, (y << shift) + half).
     //
-    SDL_Texture* tex = SDL_CreateTextureFromSurface(_renderer, surf);
-    if (tex == nullptr)
-    {
-      SDL_FreeSurface(surf);
-      SDL_Log("SDL_CreateTextureFromSurface() fail - %s", SDL_GetError());
-      return -1;
-    }
-
-    _textureHandleCounter++;
+    const int64_t half = ((int64_t)1 << shift) >> 1;
 
-    _texturesByHandle[_textureHandleCounter] = { fname, surf, tex };
+    int64_t xMin = std::min( std::min(X[0], X[1]), X[2]);
+    int64_t yMin = std::min( std::min(Y[0], Y[1]), Y[2]);
+    int64_t xMax = std::max( std::max(X[0], X[1]), X[2]);
+    int64_t yMax = std::max( std::max(Y[0], Y[1]), Y[2]);
 
-    SDL_Log("%s", ToString(_texturesByHandle[_textureHandleCounter]).data());
+    int lastPixel = (int)_frameBufferSize - 1;
 
-    _textureHandleByFname[fname] = _textureHandleCounter;
+    ts.XMin = std::max((int)((xMin - half) >> shift), 0);
+    ts.YMin = std::max((int)((yMin - half) >> shift), 0);
+    ts.XMax = std::min((int)((xMax - half) >> shift), lastPixel);
+    ts.YMax = std::min((int)((yMax - half) >> shift), lastPixel);
 
-    return _textureHandleCounter;
-  }
+    int sign = (area > 0) ? 1 : -1;
 
-  // ---------------------------------------------------------------------------
+    int64_t bias[3];
 
-  uint32_t DrawWrapper::ReadTexel(int handle, int x, int y, bool wrap)
-  {
-    if (_texturesByHandle.count(handle) == 0)
+    for (int i = 0; i < 3; i++)
     {
-      SDL_Log("Texture handle %d not found!", handle);
-      return -1;
-    }
+      int from = i;
+      int to   = (i + 1) % 3;
 
-    const TextureData& td = _texturesByHandle[handle];
+      int64_t a = sign * (Y[from] - Y[to]);
+      int64_t b = sign * (X[to]   - X[from]);
+      int64_t c = -(a * X[from] + b * Y[from]);
 
-    //printf("%s", ToString(td.Surface).data());
-    //printf("%s", DumpPixels(td.Surface).data());
+      //
+      // Same thing as in tests/pit-rasterizer-tlr: inside is on the right
+      // (positive) side of every edge, so edge is a left one if w grows
+      // with x, and a top one if it's horizontal and w grows with y
+      // (downwards). Pixels exactly on any other edge get pushed out.
+      //
+      bool isTopLeft = (a > 0 or (a == 0 and b > 0));
 
-    int nx = x;
-    int ny = y;
+      bias[i] = isTopLeft ? 0 : -1;
 
-    if (wrap)
-    {
-      nx %= td.Surface->w;
-      ny %= td.Surface->h;
+      //
+      // Switch to pixel coordinates.
+      //
+      ts.A[i] = a * ((int64_t)1 << shift);
+      ts.B[i] = b * ((int64_t)1 << shift);
+      ts.C[i] = c + (a + b) * half;
     }
-    else
+
+    ts.DepthTest = depthTest;
+
+    double invArea = 1.0 / (double)(sign * area);
+
+    if (ts.DepthTest)
     {
-      nx = Clamp(nx, 0, td.Surface->w - 1);
-      ny = Clamp(ny, 0, td.Surface->h - 1);
+      //
+      // Each edge function weights the vertex opposite to its edge. Bias is
+      // not applied yet, so depth plane is exact.
+      //
+      ts.ZdX = ( ts.A[1] * p1.Z + ts.A[2] * p2.Z + ts.A[0] * p3.Z ) * invArea;
+      ts.ZdY = ( ts.B[1] * p1.Z + ts.B[2] * p2.Z + ts.B[0] * p3.Z ) * invArea;
+      ts.Z0  = ( ts.C[1] * p1.Z + ts.C[2] * p2.Z + ts.C[0] * p3.Z ) * invArea;
     }
 
-    uint8_t* pix = (uint8_t*)td.Surface->pixels;
+    ts.Texture = (textured != nullptr) ? textured->Texture : nullptr;
 
-    uint8_t bpp = td.Surface->format->BytesPerPixel;
+    if (ts.Texture != nullptr)
+    {
+      const PipelineItem::Point* p = textured->Points;
 
-    //
-    // Same old bullshit: because array's rows and columns are not the same as
-    // X and Y of the image, we have to flip them to access raw pixel data
-    // properly.
-    //
-    // Screen: [ 9 ; 1 ] -> Array: 1st row, 9th column
-    //
-    // A little bit of additional mindfuck since necessary data is stored as 1D
-    // array.
-    //
-#if SDL_BYTEORDER == __LITTLE_ENDIAN
-    uint8_t b = pix[(nx * bpp + 0) + ny * td.Surface->pitch];
-    uint8_t g = pix[(nx * bpp + 1) + ny * td.Surface->pitch];
-    uint8_t r = pix[(nx * bpp + 2) + ny * td.Surface->pitch];
+      //
+      // Texture rows go from the top, while V goes from the bottom.
+      //
+      double w = (double)ts.Texture->Width;
+      double h = (double)ts.Texture->Height;
 
-    uint8_t a = 0;
+      double q[3];
+      double s[3];
+      double t[3];
 
-    if (bpp == 4)
-    {
-      a = pix[(nx * bpp + 3) + ny * td.Surface->pitch];
-    }
-#else
-    uint8_t r, g, b, a = 255;
+      for (int i = 0; i < 3; i++)
+      {
+        q[i] = p[i].InvW;
+        s[i] = p[i].U * w * q[i];
+        t[i] = (1.0 - p[i].V) * h * q[i];
+      }
 
-    if (bpp == 4)
-    {
-      a = pix[(nx * bpp + 0) + ny * td.Surface->pitch];
-      r = pix[(nx * bpp + 1) + ny * td.Surface->pitch];
-      g = pix[(nx * bpp + 2) + ny * td.Surface->pitch];
-      b = pix[(nx * bpp + 3) + ny * td.Surface->pitch];
+      //
+      // Same thing as with depth above.
+      //
+      auto plane = [&ts, invArea](const double (&v)[3],
+                                  double& v0,
+                                  double& dX,
+                                  double& dY)
+      {
+        dX = ( ts.A[1] * v[0] + ts.A[2] * v[1] + ts.A[0] * v[2] ) * invArea;
+        dY = ( ts.B[1] * v[0] + ts.B[2] * v[1] + ts.B[0] * v[2] ) * invArea;
+        v0 = ( ts.C[1] * v[0] + ts.C[2] * v[1] + ts.C[0] * v[2] ) * invArea;
+      };
+
+      plane(q, ts.Q0, ts.QdX, ts.QdY);
+      plane(s, ts.S0, ts.SdX, ts.SdY);
+      plane(t, ts.T0, ts.TdX, ts.TdY);
     }
-    else
+
+    for (int i = 0; i < 3; i++)
     {
-      r = pix[(nx * bpp + 0) + ny * td.Surface->pitch];
-      g = pix[(nx * bpp + 1) + ny * td.Surface->pitch];
-      b = pix[(nx * bpp + 2) + ny * td.Surface->pitch];
+      ts.C[i] += bias[i];
     }
-#endif
 
-    uint32_t color = 0x0;
+    uint32_t alpha = (colorMask & _maskA) >> 24;
 
-    if (bpp == 4)
-    {
-      color = ( b | (g << 8) | (r << 16) | (a << 24) );
-    }
-    else
-    {
-      color = ( b | (g << 8) | (r << 16) );
-    }
+    ts.Opaque    = (alpha == 0 or alpha == 0xFF);
+    ts.ColorMask = colorMask;
 
-    return color;
+    return true;
   }
 
   // ---------------------------------------------------------------------------
 
-  DrawWrapper::TextureData* DrawWrapper::GetTexture(int handle)
+  bool DrawWrapper::SetupTileEdges(const TriangleSetup& ts,
+                                   int x0, int y0, int x1, int y1,
+                                   TileEdges& edges)
   {
-    return (_texturesByHandle.count(handle) == 1)
-          ? &_texturesByHandle[handle]
-          : nullptr;
-  }
+    edges.FullyCovered = true;
 
-  // ---------------------------------------------------------------------------
+    for (int i = 0; i < 3; i++)
+    {
+      int64_t w = ts.A[i] * x0 + ts.B[i] * y0 + ts.C[i];
 
-  void DrawWrapper::Stop()
-  {
-    _running = false;
+      //
+      // Edge functions are linear, so their extremes over the rectangle are
+      // at its corners.
+      //
+      int64_t dx = ts.A[i] * (x1 - x0);
+      int64_t dy = ts.B[i] * (y1 - y0);
+
+      int64_t wMin = w + std::min(dx, (int64_t)0) + std::min(dy, (int64_t)0);
+      int64_t wMax = w + std::max(dx, (int64_t)0) + std::max(dy, (int64_t)0);
+
+      if (wMax < 0)
+      {
+        return false;
+      }
+
+      if (wMin >= 0)
+      {
+        edges.W[i]  = 0;
+        edges.DX[i] = 0;
+        edges.DY[i] = 0;
+      }
+      else
+      {
+        edges.W[i]  = (int32_t)w;
+        edges.DX[i] = (int32_t)ts.A[i];
+        edges.DY[i] = (int32_t)ts.B[i];
+
+        edges.FullyCovered = false;
+      }
+    }
+
+    return true;
   }
 
   // ---------------------------------------------------------------------------
 
-  void DrawWrapper::DrawPoint(const SDL_Point &p, uint32_t colorMask)
+  bool DrawWrapper::RasterizeSubpixel(const Vec3& p1,
+                                      const Vec3& p2,
+                                      const Vec3& p3,
+                                      bool depthTest,
+                                      uint32_t colorMask)
   {
-    INIT_CHECK();
-
-    _drawCalls++;
-
-    SaveColor();
+    TriangleSetup ts;
 
-    if (( colorMask & _maskA) != 0)
+    if (not SetupTriangle(p1, p2, p3, depthTest, colorMask, ts))
     {
-      SDL_SetRenderDrawBlendMode(_renderer, SDL_BLENDMODE_BLEND);
+      return false;
     }
-    else
+
+    if (ts.XMin > ts.XMax or ts.YMin > ts.YMax)
     {
-      SDL_SetRenderDrawBlendMode(_renderer, SDL_BLENDMODE_NONE);
+      return true;
     }
 
-    HTML2RGBA(colorMask);
-
-    SDL_SetRenderDrawColor(_renderer,
-                           _drawColor.r,
-                           _drawColor.g,
-                           _drawColor.b,
-                           _drawColor.a);
-
-    SDL_RenderDrawPoint(_renderer, p.x, p.y);
+    //
+    // Single triangle has nothing to be binned with, so just walk over the
+    // tiles it touches.
+    //
+    for (int ty = ts.YMin / kBinSize; ty <= ts.YMax / kBinSize; ty++)
+    {
+      for (int tx = ts.XMin / kBinSize; tx <= ts.XMax / kBinSize; tx++)
+      {
+        RasterizeTile(ts, tx, ty);
+      }
+    }
 
-    RestoreColor();
+    return true;
   }
 
   // ---------------------------------------------------------------------------
 
-  void DrawWrapper::DrawLine(const SDL_Point& p1,
-                             const SDL_Point& p2,
-                             uint32_t colorMask)
+  bool DrawWrapper::BinTriangle(const PipelineItem& tri)
   {
-    INIT_CHECK();
-
-    _drawCalls++;
+    TriangleSetup ts;
 
-    SaveColor();
+    auto toVec3 = [](const PipelineItem::Point& p)
+    {
+      return Vec3{ p.X, p.Y, p.Z };
+    };
 
-    if (( colorMask & _maskA ) != 0)
+    if (not SetupTriangle(toVec3(tri.Points[0]),
+                          toVec3(tri.Points[1]),
+                          toVec3(tri.Points[2]),
+                          tri.DepthTestFlag,
+                          tri.ColorMask,
+                          ts,
+                          &tri))
     {
-      SDL_SetRenderDrawBlendMode(_renderer, SDL_BLENDMODE_BLEND);
+      return false;
     }
-    else
+
+    _drawCalls++;
+
+    if (ts.XMin > ts.XMax or ts.YMin > ts.YMax)
     {
-      SDL_SetRenderDrawBlendMode(_renderer, SDL_BLENDMODE_NONE);
+      return true;
     }
 
-    HTML2RGBA(colorMask);
+    uint32_t index = _setups.size();
 
-    SDL_SetRenderDrawColor(_renderer,
-                            _drawColor.r,
-                            _drawColor.g,
-                            _drawColor.b,
-                            _drawColor.a);
-
-    SDL_RenderDrawLine(_renderer, p1.x, p1.y, p2.x, p2.y);
+    _setups.push_back(ts);
 
-    RestoreColor();
-  }
+    int tx0 = ts.XMin / kBinSize;
+    int ty0 = ts.YMin / kBinSize;
+    int tx1 = ts.XMax / kBinSize;
+    int ty1 = ts.YMax / kBinSize;
 
-  // ---------------------------------------------------------------------------
+    int lastPixel = (int)_frameBufferSize - 1;
 
-  void DrawWrapper::DrawTriangle(const SDL_Point& p1,
-                                 const SDL_Point& p2,
-                                 const SDL_Point& p3,
-                                 uint32_t colorMask,
-                                 RenderMode mode)
-  {
-    INIT_CHECK();
+    TileEdges edges;
 
-    switch (mode)
+    for (int ty = ty0; ty <= ty1; ty++)
     {
-      case RenderMode::SOLID:
-        FillTriangle(p1, p2, p3, colorMask);
-        break;
+      int y0 = ty * kBinSize;
+      int y1 = std::min(y0 + kBinSize - 1, lastPixel);
 
-      case RenderMode::WIREFRAME:
-        DrawLine(p1, p2, colorMask);
-        DrawLine(p2, p3, colorMask);
-        DrawLine(p1, p3, colorMask);
-        break;
+      for (int tx = tx0; tx <= tx1; tx++)
+      {
+        int x0 = tx * kBinSize;
+        int x1 = std::min(x0 + kBinSize - 1, lastPixel);
 
-      case RenderMode::MIXED:
-        FillTriangle(p1, p2, p3, colorMask);
-        DrawLine(p1, p2, 0);
-        DrawLine(p2, p3, 0);
-        DrawLine(p1, p3, 0);
-        break;
+        if (not SetupTileEdges(ts, x0, y0, x1, y1, edges))
+        {
+          continue;
+        }
 
-      default:
-        SDL_Log("Unexpected mode %d!", (int)mode);
-        break;
+        std::vector<uint32_t>& bin = _bins[ty * _binsX + tx];
+
+        if (bin.empty())
+        {
+          _activeBins.push_back(ty * _binsX + tx);
+        }
+
+        bin.push_back(index);
+      }
     }
+
+    return true;
   }
 
   // ---------------------------------------------------------------------------
 
-  void DrawWrapper::DrawTriangle(const Vec3& p1,
-                                 const Vec3& p2,
-                                 const Vec3& p3,
-                                 uint32_t colorMask,
-                                 RenderMode mode)
+  void DrawWrapper::FlushBins()
   {
-    DrawTriangle(SDL_Point{ (int32_t)p1.X, (int32_t)p1.Y },
-                 SDL_Point{ (int32_t)p2.X, (int32_t)p2.Y },
-                 SDL_Point{ (int32_t)p3.X, (int32_t)p3.Y },
-                 colorMask,
-                 mode);
+    if (_setups.empty())
+    {
+      return;
+    }
+
+    _workers.ParallelFor(_activeBins.size(), [this](size_t i)
+    {
+      uint32_t binIndex = _activeBins[i];
+
+      int tx = binIndex % _binsX;
+      int ty = binIndex / _binsX;
+
+      std::vector<uint32_t>& bin = _bins[binIndex];
+
+      //
+      // Submission order is preserved within each tile, so result doesn't
+      // depend on how tiles were spread over threads.
+      //
+      for (uint32_t index : bin)
+      {
+        RasterizeTile(_setups[index], tx, ty);
+      }
+
+      bin.clear();
+    });
+
+    _activeBins.clear();
+    _setups.clear();
   }
 
   // ---------------------------------------------------------------------------
 
-  void DrawWrapper::FillTriangle(const SDL_Point& p1,
-                                 const SDL_Point& p2,
-                                 const SDL_Point& p3,
-                                 uint32_t colorMask)
+  void DrawWrapper::RasterizeTile(const TriangleSetup& ts, int tileX, int tileY)
   {
-    INIT_CHECK();
+    int x0 = std::max(tileX * kBinSize, ts.XMin);
+    int y0 = std::max(tileY * kBinSize, ts.YMin);
+    int x1 = std::min(tileX * kBinSize + kBinSize - 1, ts.XMax);
+    int y1 = std::min(tileY * kBinSize + kBinSize - 1, ts.YMax);
 
-    int xMin = std::min( std::min(p1.x, p2.x), p3.x);
-    int yMin = std::min( std::min(p1.y, p2.y), p3.y);
-    int xMax = std::max( std::max(p1.x, p2.x), p3.x);
-    int yMax = std::max( std::max(p1.y, p2.y), p3.y);
+    TileEdges edges;
 
-    for (int x = xMin; x <= xMax; x++)
+    if (not SetupTileEdges(ts, x0, y0, x1, y1, edges))
     {
-      for (int y = yMin; y <= yMax; y++)
-      {
-        SDL_Point p = { x, y };
+      return;
+    }
 
-        //
-        // This way it works a little bit faster it seems.
-        //
-        int w0 = (p2.x - p1.x) * (p.y - p1.y) - (p2.y - p1.y) * (p.x - p1.x);
-        int w1 = (p3.x - p2.x) * (p.y - p2.y) - (p3.y - p2.y) * (p.x - p2.x);
-        int w2 = (p1.x - p3.x) * (p.y - p3.y) - (p1.y - p3.y) * (p.x - p3.x);
+    if (ts.Texture != nullptr)
+    {
+      RasterizeTileTextured(ts, edges, x0, y0, x1, y1);
+      return;
+    }
 
-        bool inside = (w0 <= 0 and w1 <= 0 and w2 <= 0)
-                   or (w0 >= 0 and w1 >= 0 and w2 >= 0);
+    bool vectorizable = ts.Opaque
+                    and (not ts.DepthTest
+                      or _depthBuffer.Format() == DepthFormat::FLOAT32);
 
-        if (inside)
+#ifdef SW3D_X86
+    if (vectorizable and _simdLevel != SimdLevel::SCALAR)
+    {
+      //
+      // Vector kernels access depth buffer directly, so make sure it holds
+      // valid data under the whole area first.
+      //
+      if (ts.DepthTest)
+      {
+        for (int dy = (y0 >> DepthBuffer::kTileShift);
+                 dy <= (y1 >> DepthBuffer::kTileShift);
+                 dy++)
         {
-          DrawPoint(p, colorMask);
+          for (int dx = (x0 >> DepthBuffer::kTileShift);
+                   dx <= (x1 >> DepthBuffer::kTileShift);
+                   dx++)
+          {
+            _depthBuffer.PrepareTile(dx, dy);
+          }
         }
       }
+
+      if (_simdLevel == SimdLevel::AVX2)
+      {
+        RasterizeTileAVX2(ts, edges, x0, y0, x1, y1);
+      }
+      else
+      {
+        RasterizeTileSSE2(ts, edges, x0, y0, x1, y1);
+      }
+
+      return;
     }
+#else
+    (void)vectorizable;
+#endif
+
+    RasterizeTileScalar(ts, edges, x0, y0, x1, y1);
   }
 
   // ---------------------------------------------------------------------------
 
-  void DrawWrapper::SetCullFaceMode(CullFaceMode modeToSet)
+  void DrawWrapper::RasterizeTileScalar(const TriangleSetup& ts,
+                                        const TileEdges& edges,
+                                        int x0, int y0, int x1, int y1)
   {
-    _cullFaceMode = modeToSet;
-  }
+    uint32_t color = ts.ColorMask | _maskA;
 
-  // ---------------------------------------------------------------------------
+    for (int y = y0; y <= y1; y++)
+    {
+      uint32_t* row = &_colorBuffer[y * _frameBufferSize];
 
-  void DrawWrapper::SetMatrixMode(MatrixMode modeToSet)
-  {
-    _matrixMode = modeToSet;
-  }
+      //
+      // Depth is evaluated from the row start for every pixel instead of
+      // being stepped, so that vector kernels come up with exactly the same
+      // values.
+      //
+      double zRow = ts.Z0 + ts.ZdY * y;
 
-  // ---------------------------------------------------------------------------
+      int32_t w0 = edges.W[0] + edges.DY[0] * (y - y0);
+      int32_t w1 = edges.W[1] + edges.DY[1] * (y - y0);
+      int32_t w2 = edges.W[2] + edges.DY[2] * (y - y0);
 
-  void DrawWrapper::SetRenderMode(RenderMode modeToSet)
-  {
-    _renderMode = modeToSet;
-  }
+      bool wasInside = false;
 
-  // ---------------------------------------------------------------------------
+      for (int x = x0; x <= x1; x++)
+      {
+        if ((w0 | w1 | w2) >= 0)
+        {
+          wasInside = true;
 
-  void DrawWrapper::SetShadingMode(ShadingMode modeToSet)
-  {
-    _shadingMode = modeToSet;
-  }
+          double depth = zRow + ts.ZdX * (double)x;
 
-  // ---------------------------------------------------------------------------
+          if (not ts.DepthTest or _depthBuffer.TestAndSet(x, y, depth))
+          {
+            if (ts.Opaque)
+            {
+              row[x] = color;
+            }
+            else
+            {
+              PutPixel(x, y, ts.ColorMask);
+            }
+          }
+        }
+        else if (wasInside)
+        {
+          break;
+        }
 
-  void DrawWrapper::ClearDepthBuffer()
-  {
-    for (size_t x = 0; x < _frameBufferSize; x++)
-    {
-      for (size_t y = 0; y < _frameBufferSize; y++)
-      {
-        _depthBuffer[x][y] = std::numeric_limits<double>::infinity();
+        w0 += edges.DX[0];
+        w1 += edges.DX[1];
+        w2 += edges.DX[2];
       }
     }
   }
 
   // ---------------------------------------------------------------------------
 
-  void DrawWrapper::PushMatrix()
+  void DrawWrapper::RasterizeTileTextured(const TriangleSetup& ts,
+                                          const TileEdges& edges,
+                                          int x0, int y0, int x1, int y1)
   {
-    switch (_matrixMode)
+    const Sampler& smp = *ts.Texture;
+
+    //
+    // Shading is the same in all channels, see ApplyShading().
+    //
+    const uint32_t shade = (ts.ColorMask & _maskB) + 1;
+
+    //
+    // Texel coordinates are stepped in 16.16 fixed point, 64 bits wide so
+    // that repeated textures can't overflow it.
+    //
+    constexpr double kFixedOne = 65536.0;
+
+    auto putTexel = [this, &smp, &ts, shade](uint32_t* row,
+                                            int x,
+                                            int y,
+                                            int64_t s,
+                                            int64_t t)
     {
-      case MatrixMode::PROJECTION:
+      double depth = ts.Z0 + ts.ZdY * y + ts.ZdX * (double)x;
+
+      if (ts.DepthTest and not _depthBuffer.TestAndSet(x, y, depth))
       {
-        if (_projectionStack.size() < SW3D::Constants::kMatrixStackLimit)
-        {
-          _projectionStack.push({ _projectionMatrix, _projectionMode });
-        }
-        else
-        {
-          SW3D::Error = EngineError::STACK_OVERFLOW;
-        }
+        return;
       }
-      break;
 
-      case MatrixMode::MODELVIEW:
+      uint32_t texel = smp.Fetch((int)(s >> 16), (int)(t >> 16));
+
+      uint32_t r = ( ((texel >> 16) & 0xFF) * shade ) >> 8;
+      uint32_t g = ( ((texel >> 8)  & 0xFF) * shade ) >> 8;
+      uint32_t b = ( ( texel        & 0xFF) * shade ) >> 8;
+
+      row[x] = _maskA | (r << 16) | (g << 8) | b;
+    };
+
+    for (int y = y0; y <= y1; y++)
+    {
+      int32_t w0 = edges.W[0] + edges.DY[0] * (y - y0);
+      int32_t w1 = edges.W[1] + edges.DY[1] * (y - y0);
+      int32_t w2 = edges.W[2] + edges.DY[2] * (y - y0);
+
+      //
+      // Triangle is convex, so it covers a single span of the row. Find it
+      // first, then texture it.
+      //
+      int xStart = x0;
+
+      while (xStart <= x1 and (w0 | w1 | w2) < 0)
       {
-        if (_modelViewStack.size() < SW3D::Constants::kMatrixStackLimit)
-        {
-          _modelViewStack.push(_modelViewMatrix);
-        }
-        else
-        {
-          SW3D::Error = EngineError::STACK_OVERFLOW;
-        }
+        w0 += edges.DX[0];
+        w1 += edges.DX[1];
+        w2 += edges.DX[2];
+
+        xStart++;
       }
-      break;
 
-      default:
-        SW3D::Error = EngineError::INVALID_MODE;
-        break;
-    }
-  }
+      if (xStart > x1)
+      {
+        continue;
+      }
 
-  // ---------------------------------------------------------------------------
+      int xEnd = xStart;
 
-  void DrawWrapper::PopMatrix()
-  {
-    switch (_matrixMode)
-    {
-      case MatrixMode::PROJECTION:
+      while (xEnd < x1)
       {
-        if (_projectionStack.size() > 1)
-        {
-          //
-          // After we save current projection matrix with PushMatrix() it's
-          // placed on top of the stack. So after that any changes to projection
-          // will modify current projection matrix. When we're done with it and
-          // want to go back to previous projection, it's *on top* of the stack,
-          // so we need to assign it to the current projection matrix variable
-          // first and pop the stack afterwards.
-          //
-          _projectionMatrix = _projectionStack.top().first;
-          _projectionMode   = _projectionStack.top().second;
+        w0 += edges.DX[0];
+        w1 += edges.DX[1];
+        w2 += edges.DX[2];
 
-          _projectionStack.pop();
-        }
-        else
+        if ((w0 | w1 | w2) < 0)
         {
-          SW3D::Error = EngineError::STACK_UNDERFLOW;
+          break;
         }
+
+        xEnd++;
       }
-      break;
 
-      case MatrixMode::MODELVIEW:
+      uint32_t* row = &_colorBuffer[y * _frameBufferSize];
+
+      double q = ts.Q0 + ts.QdY * y + ts.QdX * (double)xStart;
+      double s = ts.S0 + ts.SdY * y + ts.SdX * (double)xStart;
+      double t = ts.T0 + ts.TdY * y + ts.TdX * (double)xStart;
+
+      double u = s / q;
+      double v = t / q;
+
+      int x = xStart;
+
+      //
+      // Quake style: true texture coordinates at both ends of every
+      // subspan, linear in between. Subspans end on the last pixel of
+      // the span, so it's never extrapolated beyond the triangle.
+      //
+      while (x < xEnd)
       {
-        //
-        // Both stacks contain identity matrix from the start, but because
-        // identity modelview matrix corresponds to "no change" it doesn't
-        // matter what order to reassign modelview matrix variable is used, but
-        // for consistency's sake let's rewrite it as with projection matrix
-        // case.
-        //
-        if (_modelViewStack.size() > 1)
-        {
-          _modelViewMatrix = _modelViewStack.top();
-          _modelViewStack.pop();
-        }
-        else
+        int steps = std::min(kTextureSubspan, xEnd - x);
+
+        q += ts.QdX * steps;
+        s += ts.SdX * steps;
+        t += ts.TdX * steps;
+
+        double uNext = s / q;
+        double vNext = t / q;
+
+        int64_t fs  = (int64_t)(u * kFixedOne);
+        int64_t ft  = (int64_t)(v * kFixedOne);
+        int64_t dfs = (int64_t)((uNext - u) * kFixedOne / steps);
+        int64_t dft = (int64_t)((vNext - v) * kFixedOne / steps);
+
+        for (int i = 0; i < steps; i++)
         {
-          SW3D::Error = EngineError::STACK_UNDERFLOW;
+          putTexel(row, x + i, y, fs, ft);
+
+          fs += dfs;
+          ft += dft;
         }
+
+        x += steps;
+
+        u = uNext;
+        v = vNext;
       }
-      break;
 
-      default:
-        SW3D::Error = EngineError::INVALID_MODE;
-        break;
+      putTexel(row, xEnd, y, (int64_t)(u * kFixedOne), (int64_t)(v * kFixedOne));
     }
   }
 
   // ---------------------------------------------------------------------------
 
-  SDL_Renderer* DrawWrapper::GetRenderer() const
+#ifdef SW3D_X86
+  //
+  // Pixels are processed in groups of 4 aligned to multiple of 4 in x, so
+  // that depth buffer (64 byte aligned with 64 byte aligned rows) can be
+  // accessed with aligned loads and stores. Lanes outside of [x0 ; x1] are
+  // masked out.
+  //
+  void DrawWrapper::RasterizeTileSSE2(const TriangleSetup& ts,
+                                      const TileEdges& edges,
+                                      int x0, int y0, int x1, int y1)
   {
-    return _renderer;
-  }
+    const uint32_t color = ts.ColorMask | _maskA;
 
-  // ---------------------------------------------------------------------------
+    const __m128i laneIndex = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i colorVec  = _mm_set1_epi32((int)color);
+    const __m128i x0Vec     = _mm_set1_epi32(x0 - 1);
+    const __m128i x1Vec     = _mm_set1_epi32(x1 + 1);
 
-  const double& DrawWrapper::DeltaTime() const
-  {
-    return _deltaTime;
-  }
+    __m128i a[3];
+    __m128i aStep[3];
 
-  // ---------------------------------------------------------------------------
+    for (int i = 0; i < 3; i++)
+    {
+      int32_t dx = edges.DX[i];
 
-  const double& DrawWrapper::DrawTime() const
-  {
-    return _drawTime;
-  }
+      a[i]     = _mm_set_epi32(3 * dx, 2 * dx, dx, 0);
+      aStep[i] = _mm_set1_epi32(4 * dx);
+    }
 
-  // ---------------------------------------------------------------------------
+    const __m128d zdx = _mm_set1_pd(ts.ZdX);
 
-  const size_t& DrawWrapper::FrameBufferSize() const
-  {
-    return _frameBufferSize;
-  }
+    float* depthData = (float*)_depthBuffer.Data();
+    size_t depthPitch = _depthBuffer.Pitch();
 
-  // ---------------------------------------------------------------------------
+    int xa = (x0 & ~3);
 
-  const size_t& DrawWrapper::DrawCalls() const
-  {
-    return _drawCalls;
-  }
+    for (int y = y0; y <= y1; y++)
+    {
+      uint32_t* row = &_colorBuffer[y * _frameBufferSize];
+      float* depthRow = depthData + y * depthPitch;
 
-  // ---------------------------------------------------------------------------
+      __m128i w[3];
 
-  void DrawWrapper::SetWeakPerspective()
-  {
-    _projectionMatrix = Matrix::WeakPerspective();
-    _projectionMode = ProjectionMode::WEAK_PERSPECTIVE;
-  }
+      for (int i = 0; i < 3; i++)
+      {
+        int32_t wStart = edges.W[i]
+                       + edges.DY[i] * (y - y0)
+                       - edges.DX[i] * (x0 - xa);
 
-  // ---------------------------------------------------------------------------
+        w[i] = _mm_add_epi32(_mm_set1_epi32(wStart), a[i]);
+      }
 
-  void DrawWrapper::SetPerspective(double fov,
-                                   double aspectRatio,
-                                   double zNear,
-                                   double zFar)
-  {
-    _projectionMatrix = Matrix::Perspective(fov,
-                                            aspectRatio,
-                                            zNear,
-                                            zFar);
-    _projectionMode = ProjectionMode::PERSPECTIVE;
-  }
+      __m128d zRow = _mm_set1_pd(ts.Z0 + ts.ZdY * y);
 
-  // ---------------------------------------------------------------------------
+      __m128i xs = _mm_add_epi32(_mm_set1_epi32(xa), laneIndex);
 
-  void DrawWrapper::SetOrthographic(double left, double right,
-                                    double top, double bottom,
-                                    double near, double far)
-  {
-    _projectionMatrix = Matrix::Orthographic(left, right,
-                                             top, bottom,
-                                             near, far);
-    _projectionMode = ProjectionMode::ORTHOGRAPHIC;
-  }
+      bool wasInside = false;
 
-  // ---------------------------------------------------------------------------
+      for (int x = xa; x <= x1; x += 4)
+      {
+        __m128i mask = _mm_and_si128(_mm_cmpgt_epi32(xs, x0Vec),
+                                     _mm_cmplt_epi32(xs, x1Vec));
 
-  void DrawWrapper::ApplyShading(const Vec3& lookVector, Triangle& face)
-  {
-    static Vec3 v1, v2, n, fv;
-    static double dp;
+        if (not edges.FullyCovered)
+        {
+          __m128i e = _mm_or_si128(_mm_or_si128(w[0], w[1]), w[2]);
+          mask = _mm_andnot_si128(_mm_srai_epi32(e, 31), mask);
+        }
 
-    v1 = face.Points[1].Position - face.Points[0].Position;
-    v2 = face.Points[2].Position - face.Points[0].Position;
-    n  = SW3D::CrossProduct(v1, v2);
+        w[0] = _mm_add_epi32(w[0], aStep[0]);
+        w[1] = _mm_add_epi32(w[1], aStep[1]);
+        w[2] = _mm_add_epi32(w[2], aStep[2]);
 
-    //
-    // For backface culling this is not necessary, but for shading it is.
-    //
-    n.Normalize();
+        xs = _mm_add_epi32(xs, _mm_set1_epi32(4));
 
-    fv = (_projectionMode == ProjectionMode::ORTHOGRAPHIC)
-         ? Vec3::In()
-         : face.Points[0].Position; // - camera
+        if (_mm_movemask_ps(_mm_castsi128_ps(mask)) == 0)
+        {
+          if (wasInside)
+          {
+            break;
+          }
 
-    fv.Normalize();
+          continue;
+        }
 
-    dp = SW3D::DotProduct(fv, n);
+        wasInside = true;
 
-    if (dp < 0.0)
-    {
-      dp = -dp;
-    }
+        if (ts.DepthTest)
+        {
+          __m128d xLo = _mm_set_pd((double)(x + 1), (double)x);
+          __m128d xHi = _mm_set_pd((double)(x + 3), (double)(x + 2));
 
-    uint8_t grayscalePart = (uint8_t)(255.0 * dp);
+          __m128 zLo = _mm_cvtpd_ps(_mm_add_pd(zRow, _mm_mul_pd(zdx, xLo)));
+          __m128 zHi = _mm_cvtpd_ps(_mm_add_pd(zRow, _mm_mul_pd(zdx, xHi)));
+          __m128 z   = _mm_movelh_ps(zLo, zHi);
 
-    if (face.ShadingMode_ == ShadingMode::NONE)
-    {
-      grayscalePart = 255;
-    }
+          __m128 stored = _mm_load_ps(depthRow + x);
 
-    //
-    // Everything is one color for now.
-    //
-    face.Points[0].Color[0] = grayscalePart;
-    face.Points[0].Color[1] = grayscalePart;
-    face.Points[0].Color[2] = grayscalePart;
-    face.Points[0].Color[3] = 255;
+          __m128 pass = _mm_and_ps(_mm_cmplt_ps(z, stored),
+                                   _mm_castsi128_ps(mask));
 
-    face.Points[1].Color[0] = grayscalePart;
-    face.Points[1].Color[1] = grayscalePart;
-    face.Points[1].Color[2] = grayscalePart;
-    face.Points[1].Color[3] = 255;
+          _mm_store_ps(depthRow + x,
+                       _mm_or_ps(_mm_and_ps(pass, z),
+                                 _mm_andnot_ps(pass, stored)));
 
-    face.Points[2].Color[0] = grayscalePart;
-    face.Points[2].Color[1] = grayscalePart;
-    face.Points[2].Color[2] = grayscalePart;
-    face.Points[2].Color[3] = 255;
+          mask = _mm_castps_si128(pass);
+        }
+
+        int bits = _mm_movemask_ps(_mm_castsi128_ps(mask));
+
+        //
+        // SSE2 has no cheap masked store and color buffer rows are neither
+        // aligned nor padded, so only whole groups are stored at once.
+        //
+        if (bits == 0xF)
+        {
+          _mm_storeu_si128((__m128i*)(row + x), colorVec);
+        }
+        else
+        {
+          for (int i = 0; i < 4; i++)
+          {
+            if (bits & (1 << i))
+            {
+              row[x + i] = color;
+            }
+          }
+        }
+      }
+    }
   }
 
   // ---------------------------------------------------------------------------
 
-  void DrawWrapper::ShouldCullFace(const Vec3& lookVector, Triangle& face)
+  //
+  // Same as above, 8 pixels at a time.
+  //
+  SW3D_TARGET_AVX2
+  void DrawWrapper::RasterizeTileAVX2(const TriangleSetup& ts,
+                                      const TileEdges& edges,
+                                      int x0, int y0, int x1, int y1)
   {
-    static Vec3 v1, v2, n, fv;
-    static double dp;
+    const uint32_t color = ts.ColorMask | _maskA;
 
-    v1 = face.Points[1].Position - face.Points[0].Position;
-    v2 = face.Points[2].Position - face.Points[0].Position;
-    n  = SW3D::CrossProduct(v1, v2);
+    const __m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i colorVec  = _mm256_set1_epi32((int)color);
+    const __m256i x0Vec     = _mm256_set1_epi32(x0 - 1);
+    const __m256i x1Vec     = _mm256_set1_epi32(x1 + 1);
 
-    //
-    // Because in perspective projection we have vanishing point, in order to
-    // properly cull faces we must compute dot product between face normal and
-    // direction vector from camera to that face.
-    // But in orthographic projection there is no vanishing point (or one can
-    // think that in this type of projection camera is moved at infinity so all
-    // vectors from camera to object are parallel), so our vector from camera to
-    // object actually doesn't make sense and thus produces wrong result.
-    // So in order to cull faces properly for orthographic projection we must
-    // use camera's direction vector towards the object.
-    //
-    // FIXME: assuming camera is at (0, 0, 0), should be fixed in the future.
-    //
-    // Can be any point of a triangle since they're all lying on the same plane.
-    //
-    fv = (_projectionMode == ProjectionMode::ORTHOGRAPHIC)
-         ? Vec3::In()
-         : face.Points[0].Position; // - camera
+    __m256i a[3];
+    __m256i aStep[3];
 
-    dp = SW3D::DotProduct(fv, n);
+    for (int i = 0; i < 3; i++)
+    {
+      a[i]     = _mm256_mullo_epi32(_mm256_set1_epi32(edges.DX[i]), laneIndex);
+      aStep[i] = _mm256_set1_epi32(8 * edges.DX[i]);
+    }
 
-    face.CullFlag = (_cullFaceMode == CullFaceMode::BACK)
-                    ? (dp >= 0.0)
-                    : (dp < 0.0);
-  }
+    const __m256d zdx    = _mm256_set1_pd(ts.ZdX);
+    const __m256d xLoOff = _mm256_setr_pd(0.0, 1.0, 2.0, 3.0);
+    const __m256d xHiOff = _mm256_setr_pd(4.0, 5.0, 6.0, 7.0);
 
-  // ---------------------------------------------------------------------------
+    float* depthData = (float*)_depthBuffer.Data();
+    size_t depthPitch = _depthBuffer.Pitch();
 
-  void DrawWrapper::Enqueue(const Triangle& t)
-  {
-    static Triangle tri;
+    int xa = (x0 & ~7);
 
-    tri.Points[0].Position = (_modelViewMatrix * t.Points[0].Position);
-    tri.Points[1].Position = (_modelViewMatrix * t.Points[1].Position);
-    tri.Points[2].Position = (_modelViewMatrix * t.Points[2].Position);
+    for (int y = y0; y <= y1; y++)
+    {
+      uint32_t* row = &_colorBuffer[y * _frameBufferSize];
+      float* depthRow = depthData + y * depthPitch;
 
-    tri.ShadingMode_ = _shadingMode;
-    tri.RenderMode_  = _renderMode;
+      __m256i w[3];
 
-    ApplyShading(Vec3::Zero(), tri);
+      for (int i = 0; i < 3; i++)
+      {
+        int32_t wStart = edges.W[i]
+                       + edges.DY[i] * (y - y0)
+                       - edges.DX[i] * (x0 - xa);
 
-    if (_cullFaceMode != CullFaceMode::NONE)
-    {
-      //
-      // Smart people say backface culling should be performed in world space.
-      //
-      ShouldCullFace(Vec3::Zero(), tri);
+        w[i] = _mm256_add_epi32(_mm256_set1_epi32(wStart), a[i]);
+      }
 
-      if (not tri.CullFlag)
+      __m256d zRow = _mm256_set1_pd(ts.Z0 + ts.ZdY * y);
+
+      __m256i xs = _mm256_add_epi32(_mm256_set1_epi32(xa), laneIndex);
+
+      bool wasInside = false;
+
+      for (int x = xa; x <= x1; x += 8)
       {
-        //
-        // Apply projection only if triangle will be visible.
-        //
-        for (size_t i = 0; i < 3; i++)
+        __m256i mask = _mm256_and_si256(_mm256_cmpgt_epi32(xs, x0Vec),
+                                        _mm256_cmpgt_epi32(x1Vec, xs));
+
+        if (not edges.FullyCovered)
         {
-          tri.Points[i].Position = (_projectionMatrix * tri.Points[i].Position);
+          __m256i e = _mm256_or_si256(_mm256_or_si256(w[0], w[1]), w[2]);
+          mask = _mm256_andnot_si256(_mm256_srai_epi32(e, 31), mask);
+        }
 
-          tri.Points[i].Position.X += 1;
-          tri.Points[i].Position.Y += 1;
+        w[0] = _mm256_add_epi32(w[0], aStep[0]);
+        w[1] = _mm256_add_epi32(w[1], aStep[1]);
+        w[2] = _mm256_add_epi32(w[2], aStep[2]);
 
-          tri.Points[i].Position.X /= 2.0;
-          tri.Points[i].Position.Y /= 2.0;
+        xs = _mm256_add_epi32(xs, _mm256_set1_epi32(8));
 
-          //
-          // Scale into view.
-          //
-          tri.Points[i].Position.X *= (double)FrameBufferSize();
-          tri.Points[i].Position.Y *= (double)FrameBufferSize();
+        if (_mm256_testz_si256(mask, mask))
+        {
+          if (wasInside)
+          {
+            break;
+          }
+
+          continue;
         }
 
-        _pipeline.push_back(tri);
-      }
-    }
-    else
-    {
-      //
-      // Not doing shit.
-      //
-      tri.CullFlag = false;
+        wasInside = true;
 
-      for (size_t i = 0; i < 3; i++)
-      {
-        tri.Points[i].Position = (_projectionMatrix * tri.Points[i].Position);
+        if (ts.DepthTest)
+        {
+          __m256d xBase = _mm256_set1_pd((double)x);
 
-        tri.Points[i].Position.X += 1;
-        tri.Points[i].Position.Y += 1;
+          __m256d xLo = _mm256_add_pd(xBase, xLoOff);
+          __m256d xHi = _mm256_add_pd(xBase, xHiOff);
 
-        tri.Points[i].Position.X /= 2.0;
-        tri.Points[i].Position.Y /= 2.0;
+          __m128 zLo = _mm256_cvtpd_ps(_mm256_add_pd(zRow,
+                                                     _mm256_mul_pd(zdx, xLo)));
+          __m128 zHi = _mm256_cvtpd_ps(_mm256_add_pd(zRow,
+                                                     _mm256_mul_pd(zdx, xHi)));
 
-        tri.Points[i].Position.X *= (double)FrameBufferSize();
-        tri.Points[i].Position.Y *= (double)FrameBufferSize();
-      }
+          __m256 z = _mm256_insertf128_ps(_mm256_castps128_ps256(zLo), zHi, 1);
+
+          __m256 stored = _mm256_load_ps(depthRow + x);
+
+          __m256 pass = _mm256_and_ps(_mm256_cmp_ps(z, stored, _CMP_LT_OQ),
+                                      _mm256_castsi256_ps(mask));
+
+          _mm256_store_ps(depthRow + x, _mm256_blendv_ps(stored, z, pass));
+
+          mask = _mm256_castps_si256(pass);
+        }
 
-      _pipeline.push_back(tri);
+        //
+        // Masked out lanes are never touched, so it's fine for them to be
+        // past the end of the row (or the whole buffer).
+        //
+        _mm256_maskstore_epi32((int*)(row + x), mask, colorVec);
+      }
     }
   }
+#endif
 
   // ---------------------------------------------------------------------------
 
-  void DrawWrapper::CommenceDraw()
+  void DrawWrapper::SetSubpixelBits(uint8_t bits)
   {
-    static Clock::time_point tp;
-
-    tp = Clock::now();
+    _subpixelBits = std::min(bits, kMaxSubpixelBits);
+  }
 
-    while (not _pipeline.empty())
-    {
-      const Triangle& tri = _pipeline.front();
+  // ---------------------------------------------------------------------------
 
-      DrawTriangle(tri.Points[0].Position,
-                   tri.Points[1].Position,
-                   tri.Points[2].Position,
-                   Array2Mask(tri.Points[0].Color),
-                   tri.RenderMode_);
+  void DrawWrapper::SetSimdLevel(SimdLevel levelToSet)
+  {
+    _simdLevel = std::min(levelToSet, DetectSimdLevel());
+  }
 
-      _pipeline.pop_front();
-    }
+  // ---------------------------------------------------------------------------
 
-    _drawTime = std::chrono::duration<double>(Clock::now() - tp ).count();
+  const SimdLevel& DrawWrapper::GetSimdLevel() const
+  {
+    return _simdLevel;
   }
 
   // ---------------------------------------------------------------------------
@@ -930,9 +3797,28 @@ namespace SW3D
       return;
     }
 
+    //
+    // Enqueued triangles point at samplers directly, so whatever is queued
+    // gets drawn while this one is still there.
+    //
+    if (not _pipeline.empty())
+    {
+      CommenceDraw();
+    }
+
     bool ok = true;
 
-    const TextureData& td = _texturesByHandle[handle];
+    TextureData& td = _texturesByHandle[handle];
+
+    if (_texture == &td.Sampler_)
+    {
+      _texture = nullptr;
+    }
+
+    td.Sampler_ = Sampler();
+
+    td.Texels     = std::vector<uint32_t>();
+    td.Pow2Texels = std::vector<uint32_t>();
 
     SDL_Log("Freeing '%s'...", td.Filename.data());
 
@@ -952,7 +3838,7 @@ namespace SW3D
       SDL_Log("  destroying texture...");
       SDL_DestroyTexture(td.Texture);
     }
-    else
+    else if (not _headless)
     {
       ok = false;
       SDL_Log("Texture is nullptr!");
@@ -1006,7 +3892,7 @@ namespace SW3D
 
   // ---------------------------------------------------------------------------
 
-  uint32_t DrawWrapper::Array2Mask(const uint8_t (&color)[4])
+  uint32_t DrawWrapper::Array2Mask(const uint8_t (&color)[4]) const
   {
     uint32_t res = 0;
 
@@ -1042,30 +3928,103 @@ namespace SW3D
 
   // ---------------------------------------------------------------------------
 
-  void DrawWrapper::DrawGrid()
+  void DrawWrapper::PutPixel(int x, int y, uint32_t colorMask)
+  {
+    if (x < 0 or y < 0
+     or x >= (int)_frameBufferSize
+     or y >= (int)_frameBufferSize)
+    {
+      return;
+    }
+
+    uint32_t& dst = _colorBuffer[y * _frameBufferSize + x];
+
+    uint32_t srcA = (colorMask & _maskA) >> 24;
+
+    //
+    // Same convention as in HTML2RGBA(): no alpha specified means opaque.
+    //
+    if (srcA == 0 or srcA == 0xFF)
+    {
+      dst = colorMask | _maskA;
+      return;
+    }
+
+    //
+    // SDL_BLENDMODE_BLEND done by hand:
+    //
+    // dstRGB = srcRGB * srcA + dstRGB * (1 - srcA)
+    // dstA   = srcA + dstA * (1 - srcA)
+    //
+    uint32_t invA = 0xFF - srcA;
+
+    uint32_t r = ( ((colorMask & _maskR) >> 16) * srcA
+                 + ((dst       & _maskR) >> 16) * invA ) / 0xFF;
+    uint32_t g = ( ((colorMask & _maskG) >> 8)  * srcA
+                 + ((dst       & _maskG) >> 8)  * invA ) / 0xFF;
+    uint32_t b = ( ( colorMask & _maskB)        * srcA
+                 + ( dst       & _maskB)        * invA ) / 0xFF;
+
+    uint32_t a = srcA + ( ((dst & _maskA) >> 24) * invA ) / 0xFF;
+
+    dst = (a << 24) | (r << 16) | (g << 8) | b;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::ClearColorBuffer()
+  {
+    //
+    // Fully transparent, so that whatever was drawn into _framebuffer with
+    // SDL calls is not covered up during UploadColorBuffer(). There's nothing
+    // underneath in headless mode, so opaque black it is.
+    //
+    std::fill(_colorBuffer.begin(), _colorBuffer.end(),
+              _headless ? _maskA : 0);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void DrawWrapper::UploadColorBuffer()
   {
-    SaveColor();
+    //
+    // The only texture upload per frame.
+    //
+    int ok = SDL_UpdateTexture(_colorBufferTexture,
+                               nullptr,
+                               _colorBuffer.data(),
+                               _frameBufferSize * sizeof(uint32_t));
+    if (ok < 0)
+    {
+      SDL_Log("%s", SDL_GetError());
+      return;
+    }
+
+    ok = SDL_RenderCopy(_renderer, _colorBufferTexture, nullptr, nullptr);
+    if (ok < 0)
+    {
+      SDL_Log("%s", SDL_GetError());
+    }
+  }
 
-    SDL_SetRenderDrawColor(_renderer, 64, 64, 64, 255);
+  // ---------------------------------------------------------------------------
 
+  void DrawWrapper::DrawGrid()
+  {
     for (int x = 0; x <= _frameBufferSize; x += 10)
     {
       for (int y = 0; y <= _frameBufferSize; y += 10)
       {
-        SDL_RenderDrawPoint(_renderer, x, y);
+        PutPixel(x, y, 0xFF404040);
       }
     }
-
-    RestoreColor();
   }
 
   // ---------------------------------------------------------------------------
 
   void DrawWrapper::RotateX(double angle)
   {
-    static Matrix r(4, 4);
-
-    r.SetIdentity();
+    Matrix4 r = Matrix4::Identity();
 
     r[0][0] = 1.0;
     r[0][1] = 0.0;
@@ -1079,16 +4038,14 @@ namespace SW3D
     r[2][1] = std::sin(angle * Constants::DEG2RAD);
     r[2][2] = std::cos(angle * Constants::DEG2RAD);
 
-    _modelViewMatrix = _modelViewMatrix * r;
+    SetModelViewMatrix(_modelViewMatrix * r);
   }
 
   // ---------------------------------------------------------------------------
 
   void DrawWrapper::RotateY(double angle)
   {
-    static Matrix r(4, 4);
-
-    r.SetIdentity();
+    Matrix4 r = Matrix4::Identity();
 
     r[0][0] = std::cos(angle * Constants::DEG2RAD);
     r[0][1] = 0.0;
@@ -1102,16 +4059,14 @@ namespace SW3D
     r[2][1] = 0.0;
     r[2][2] = std::cos(angle * Constants::DEG2RAD);
 
-    _modelViewMatrix = _modelViewMatrix * r;
+    SetModelViewMatrix(_modelViewMatrix * r);
   }
 
   // ---------------------------------------------------------------------------
 
   void DrawWrapper::RotateZ(double angle)
   {
-    static Matrix r(4, 4);
-
-    r.SetIdentity();
+    Matrix4 r = Matrix4::Identity();
 
     r[0][0] = std::cos(angle * Constants::DEG2RAD);
     r[0][1] = -std::sin(angle * Constants::DEG2RAD);
@@ -1125,22 +4080,14 @@ namespace SW3D
     r[2][1] = 0.0;
     r[2][2] = 1.0;
 
-    _modelViewMatrix = _modelViewMatrix * r;
+    SetModelViewMatrix(_modelViewMatrix * r);
   }
 
   // ---------------------------------------------------------------------------
 
   void DrawWrapper::Translate(double dx, double dy, double dz)
   {
-    static Matrix r(4, 4);
-
-    r.SetIdentity();
-
-    r[3][0] = dx;
-    r[3][1] = dy;
-    r[3][2] = dz;
-
-    _modelViewMatrix = _modelViewMatrix * r;
+    SetModelViewMatrix(_modelViewMatrix * Matrix4::Translation(dx, dy, dz));
   }
 
   // ***************************************************************************
@@ -1700,7 +4647,7 @@ namespace SW3D
 
   Vec3 CrossProduct(const Vec3& v1, const Vec3& v2)
   {
-    static Vec3 res;
+    Vec3 res;
 
     res.X = (v1.Y * v2.Z - v1.Z * v2.Y);
     res.Y = (v1.Z * v2.X - v1.X * v2.Z);
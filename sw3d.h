@@ -8,9 +8,16 @@
 #include <sstream>
 #include <iomanip>
 #include <unordered_map>
-#include <stack>
+#include <array>
 #include <fstream>
-#include <deque>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
 
 #include <SDL2/SDL.h>
 
@@ -29,18 +36,180 @@ namespace SW3D
 {
   using Clock = std::chrono::steady_clock;
   using ns    = std::chrono::nanoseconds;
-  using VVD   = std::vector<std::vector<double>>;
+
+  // ===========================================================================
+
+  //
+  // Single row-major depth buffer. Smaller values are closer (LESS depth
+  // function), cleared value is the farthest representable one: +inf for
+  // FLOAT32 and all ones for UNORM formats (depth is clamped to [0 ; 1] for
+  // them). Pipeline puts depth of both orthographic and perspective
+  // projections into [0 ; 1], weak perspective has no depth range at all.
+  //
+  // Clearing is O(1): buffer is split into kTileSize x kTileSize tiles, each
+  // tile remembers generation it was last cleared in, and Clear() just bumps
+  // current generation. Stale tile reads as cleared and gets actually filled
+  // with clear value only when something is about to be written into it.
+  //
+  class DepthBuffer
+  {
+    public:
+      static constexpr int kTileShift = 3;
+      static constexpr int kTileSize  = (1 << kTileShift);
+
+      void Init(size_t width,
+                size_t height,
+                DepthFormat format = DepthFormat::FLOAT32);
+
+      void Clear();
+
+      //
+      // Returns true and stores depth if it passed the test.
+      //
+      bool TestAndSet(int x, int y, double depth);
+      bool Test(int x, int y, double depth) const;
+
+      double Read(int x, int y) const;
+
+      //
+      // Makes sure tile holds valid data before raw access via Data().
+      //
+      void PrepareTile(int tileX, int tileY);
+
+      //
+      // Raw storage, 64 byte aligned, Pitch() is in elements (float for
+      // FLOAT32, uint32_t for UNORM24, uint16_t for UNORM16).
+      //
+      uint8_t* Data();
+      const uint8_t* Data() const;
+
+      const size_t& Width() const;
+      const size_t& Height() const;
+      const size_t& Pitch() const;
+
+      const DepthFormat& Format() const;
+
+      size_t ElementSize() const;
+
+    private:
+      uint32_t Encode(double depth) const;
+
+      bool IsTileValid(int x, int y) const;
+
+      std::vector<uint8_t> _storage;
+      uint8_t* _data = nullptr;
+
+      std::vector<uint32_t> _tileGeneration;
+
+      uint32_t _generation = 1;
+      uint32_t _clearValue = 0;
+
+      size_t _width  = 0;
+      size_t _height = 0;
+      size_t _pitch  = 0;
+      size_t _tilesX = 0;
+      size_t _tilesY = 0;
+
+      DepthFormat _format = DepthFormat::FLOAT32;
+  };
+
+  // ===========================================================================
+
+  //
+  // Fixed set of threads that sleep until there's a job for them. Job is
+  // split into indices that are grabbed one by one by whoever is free,
+  // calling thread included, and ParallelFor() returns only after all of
+  // them are done.
+  //
+  class WorkerPool
+  {
+    public:
+      ~WorkerPool();
+
+      //
+      // Total number of threads to use including the calling one, zero
+      // means as many as there are hardware threads.
+      //
+      void Start(size_t threadsTotal);
+      void Stop();
+
+      //
+      // Zero if not started.
+      //
+      size_t Size() const;
+
+      void ParallelFor(size_t count, const std::function<void(size_t)>& job);
+
+    private:
+      void WorkerLoop(uint64_t lastJobId);
+      void Drain();
+
+      std::vector<std::thread> _threads;
+
+      std::mutex _mutex;
+      std::condition_variable _jobReady;
+      std::condition_variable _jobDone;
+
+      const std::function<void(size_t)>* _job = nullptr;
+
+      size_t _count = 0;
+      std::atomic<size_t> _next { 0 };
+
+      size_t _busy = 0;
+      uint64_t _jobId = 0;
+
+      bool _started = false;
+      bool _quit    = false;
+  };
 
   // ===========================================================================
 
   class DrawWrapper
   {
     public:
+      //
+      // Texture as rasterizer sees it: power of two sized, so that wrapping
+      // around is just masking and every fetch is one index and one load.
+      //
+      struct Sampler
+      {
+        const uint32_t* Texels = nullptr;
+
+        int Width  = 0;
+        int Height = 0;
+
+        uint32_t MaskX  = 0;
+        uint32_t MaskY  = 0;
+        uint32_t ShiftY = 0;
+
+        uint32_t Fetch(int x, int y) const
+        {
+          return Texels[ ((y & MaskY) << ShiftY) | (x & MaskX) ];
+        }
+      };
+
       struct TextureData
       {
         std::string Filename;
         SDL_Surface* Surface = nullptr;
         SDL_Texture* Texture = nullptr;
+
+        //
+        // Surface decoded once at LoadTexture() into rows of ARGB8888 (images
+        // without alpha get zero alpha), in original dimensions.
+        //
+        std::vector<uint32_t> Texels;
+
+        int Width  = 0;
+        int Height = 0;
+
+        //
+        // Texels scaled up (nearest) to power of two dimensions, empty if
+        // they already are.
+        //
+        std::vector<uint32_t> Pow2Texels;
+
+        Sampler Sampler_;
       };
 
       // -----------------------------------------------------------------------
@@ -49,14 +218,60 @@ namespace SW3D
                 uint16_t windowHeight,
                 uint16_t qualityReductionFactor = 1);
 
+      //
+      // No window, no renderer, no display required. Run() will render
+      // specified number of frames into color buffer and return.
+      // DrawToScreen() and HandleEvent() are never called in this mode.
+      //
+      bool InitHeadless(uint16_t width,
+                        uint16_t height,
+                        size_t framesToRender,
+                        uint16_t qualityReductionFactor = 1);
+
       void Run(bool debugMode = false);
 
+      //
+      // Write every rendered frame in headless mode as
+      // <fnamePrefix>NNNNNN.ppm (or .bmp). Empty prefix disables dumping.
+      //
+      void SetFrameDump(const std::string& fnamePrefix,
+                        ImageFormat format = ImageFormat::PPM);
+
+      //
+      // Number of threads tiles are rasterized on, including the one
+      // CommenceDraw() is called from. Zero (default) means all hardware
+      // threads, one disables worker threads completely.
+      //
+      void SetThreadCount(size_t threadsTotal);
+      size_t GetThreadCount() const;
+
+      bool SaveFrame(const std::string& fname,
+                     ImageFormat format = ImageFormat::PPM);
+
+      //
+      // Loading the same file again replaces the texture, and triangles
+      // enqueued with the old one are drawn before that.
+      //
       int LoadTexture(const std::string& fname);
 
       uint32_t ReadTexel(int handle, int x, int y, bool wrap = true);
 
+      //
+      // Same as above for already resolved texture, doesn't touch anything
+      // else, so it's safe to call from rasterizer threads.
+      //
+      static uint32_t ReadTexel(const TextureData& td,
+                                int x,
+                                int y,
+                                bool wrap = true);
+
       TextureData* GetTexture(int handle);
 
+      //
+      // nullptr if there's no such texture.
+      //
+      const Sampler* GetSampler(int handle);
+
       SDL_Renderer* GetRenderer() const;
 
       const double& DeltaTime() const;
@@ -65,6 +280,21 @@ namespace SW3D
       const size_t& FrameBufferSize() const;
       const size_t& DrawCalls() const;
 
+      //
+      // Row-major ARGB8888, FrameBufferSize() x FrameBufferSize().
+      //
+      const std::vector<uint32_t>& GetColorBuffer() const;
+      const DepthBuffer& GetDepthBuffer() const;
+
+      //
+      // Tile fill kernels in use. Starts as the best one CPU supports, which
+      // is detected at runtime (CPUID, plus OS support for AVX state), and
+      // SetSimdLevel() can't go above that either.
+      //
+      const SimdLevel& GetSimdLevel() const;
+
+      bool IsHeadless() const;
+
     // *************************************************************************
     //
     //                               PROTECTED
@@ -105,33 +335,141 @@ namespace SW3D
                            double top,  double bottom,
                            double near, double far);
 
-      void ShouldCullFace(const Vec3& lookVector, Triangle& face);
-      void ApplyShading(const Vec3& lookVector, Triangle& face);
+      //
+      // Both work in whatever space triangle is in: lookVector is camera
+      // position and viewDirection is where camera looks (used instead of
+      // camera position in orthographic projection). Defaults are for view
+      // space. Safe to call from several threads at once.
+      //
+      void ShouldCullFace(const Vec3& lookVector,
+                          Triangle& face,
+                          const Vec3& viewDirection = Vec3::In()) const;
+
+      void ApplyShading(const Vec3& lookVector,
+                        Triangle& face,
+                        const Vec3& viewDirection = Vec3::In()) const;
 
       //
-      // Add drawing task to pipeline.
+      // Add drawing task to pipeline. Triangle is clipped against near and
+      // far planes and, if it goes beyond the guard band, against that too.
+      // Triangles outside of the view are dropped here.
       //
       void Enqueue(const Triangle& t);
 
+      //
+      // Same as calling Enqueue() for every triangle, but big batches are
+      // split between worker threads (see SetThreadCount()). Triangles end
+      // up in pipeline in the same order either way.
+      //
+      void EnqueueBatch(const std::vector<Triangle>& triangles);
+
+      //
+      // Same as calling Enqueue() for every triangle of the object, but
+      // triangles are assembled from face indices and every vertex is
+      // transformed only once per call no matter how many faces share it.
+      // Object's vertex and index buffers are used if it has them (see
+      // ModelLoader::SetMeshOutput()), faces otherwise. Objects with LODs
+      // are drawn with the one SelectLod() picks.
+      // Big objects are processed by worker threads like in EnqueueBatch().
+      //
+      void DrawIndexed(const ModelLoader::Scene& scene,
+                       const ModelLoader::Scene::Object& obj);
+
+      //
+      // Conservative test of bounds against current view frustum, false
+      // means none of it can possibly be seen. DrawIndexed() does it for
+      // every object before anything else.
+      //
+      bool IsInFrustum(const AABB& box, const BoundingSphere& sphere);
+
+      //
+      // Current view frustum in object space.
+      //
+      const Frustum& GetFrustum();
+
+      //
+      // Objects whose bounding sphere is at least that many pixels across
+      // are drawn in full detail, and every halving of that size goes one
+      // LOD down (each LOD has about a quarter of triangles, so triangles
+      // per pixel stay about the same). Zero turns LODs off.
+      //
+      void SetLodThreshold(double pixels);
+
+      //
+      // LOD of the object for current matrices, zero is full detail.
+      //
+      size_t SelectLod(const ModelLoader::Scene::Object& obj);
+
+      //
+      // Texture for filled triangles that are enqueued from now on, UV of
+      // their vertices are used as coordinates (with repeat) and texels are
+      // modulated by shading. Anything that isn't a valid handle (e.g. -1)
+      // turns texturing off. Textured triangles are always drawn by the
+      // tiled rasterizer, because others can't do texturing.
+      //
+      void SetTexture(int handle);
+
       //
       // glFlush() (or more correcly glFinish() I guess)
       //
       void CommenceDraw();
 
       //
-      // Simple rasterizer based on point inside triangle test.
+      // Half-space rasterizer, see SetRasterizerKind().
       //
       void FillTriangle(const SDL_Point& p1,
                         const SDL_Point& p2,
                         const SDL_Point& p3,
                         uint32_t colorMask);
 
+      //
+      // Same as above, but screen space Z of vertices is interpolated across
+      // the triangle and every pixel is depth tested (and written on pass)
+      // before any color work is done.
+      //
+      void FillTriangle(const Vec3& p1,
+                        const Vec3& p2,
+                        const Vec3& p3,
+                        uint32_t colorMask);
+
       void SetCullFaceMode(CullFaceMode modeToSet);
       void SetMatrixMode(MatrixMode modeToSet);
       void SetRenderMode(RenderMode modeToSet);
       void SetShadingMode(ShadingMode modeToSet);
 
+      //
+      // TILED is the default: CommenceDraw() bins whole pipeline into
+      // kBinSize x kBinSize screen tiles and rasterizes tile by tile.
+      // INCREMENTAL draws triangles one by one, PIT is the old brute force one
+      // kept around to validate pixel output against.
+      //
+      void SetRasterizerKind(RasterizerKind kindToSet);
+
+      //
+      // Vectorized triangle fill for TILED rasterizer. Defaults to the best
+      // one CPU supports, requested level is lowered to that if needed.
+      // Only used for opaque colors with FLOAT32 (or no) depth buffer, the
+      // rest always goes through scalar path.
+      //
+      void SetSimdLevel(SimdLevel levelToSet);
+
+      //
+      // Fractional bits of fixed point vertex coordinates used by TILED
+      // rasterizer (default is 4, i.e. 28.4), clamped to kMaxSubpixelBits.
+      // Pixels are sampled at their centers and ones exactly on an edge
+      // belong to the triangle only if it's a top or left edge, so triangles
+      // sharing an edge never draw the same pixel twice.
+      //
+      void SetSubpixelBits(uint8_t bits);
+
       void ClearDepthBuffer();
+      void SetDepthFormat(DepthFormat formatToSet);
+
+      //
+      // Affects triangles that are enqueued after the call.
+      // Don't forget to ClearDepthBuffer() every frame if it's enabled.
+      //
+      void SetDepthTestEnabled(bool enabled);
 
       void PushMatrix();
       void PopMatrix();
@@ -139,12 +477,31 @@ namespace SW3D
       void SaveColor();
       void RestoreColor();
 
+      //
+      // Writes directly into color buffer, no SDL calls involved.
+      //
+      void PutPixel(int x, int y, uint32_t colorMask);
+
       SDL_Renderer* _renderer = nullptr;
 
       std::string _windowName = "DrawService window";
 
-      Matrix _modelViewMatrix;
-      Matrix _projectionMatrix;
+      const Matrix4& GetModelViewMatrix() const;
+      const Matrix4& GetProjectionMatrix() const;
+
+      //
+      // Everything that changes matrices goes through these, so that what's
+      // cached from them (see GetModelViewProjection()) is brought up to
+      // date.
+      //
+      void SetModelViewMatrix(const Matrix4& m);
+      void SetProjectionMatrix(const Matrix4& m);
+
+      //
+      // Modelview times projection, recomputed only when either of them has
+      // changed since last call.
+      //
+      const Matrix4& GetModelViewProjection();
 
       uint16_t _windowWidth  = 0;
       uint16_t _windowHeight = 0;
@@ -174,24 +531,360 @@ namespace SW3D
     //
     // *************************************************************************
     private:
+      //
+      // What ends up in the pipeline: screen space triangle after clipping,
+      // with only what rasterization needs. Every one of them is written and
+      // read once per frame, so the smaller the better.
+      //
       struct PipelineItem
       {
-        Triangle Face;
-        Matrix _matProj;
-        Matrix _matView;
+        struct Point
+        {
+          float X;
+          float Y;
+          float Z;
+          float InvW;
+
+          float U;
+          float V;
+        };
+
+        Point Points[3];
+
+        uint32_t ColorMask;
+
+        const Sampler* Texture;
+
+        RenderMode RenderMode_;
+        bool DepthTestFlag;
       };
 
+      //
+      // Pipeline is never shrunk, so after first few frames it doesn't
+      // allocate at all. This is just a head start.
+      //
+      static constexpr size_t kPipelineReserve = 1 << 16;
+
+      //
+      // Screen space triangle ready for rasterization anywhere on screen.
+      // Vertices are snapped to 1 / (1 << SubpixelBits) of a pixel, edge
+      // functions w = A * x + B * y + C (all >= 0 inside, top-left rule bias
+      // already applied) and depth plane z = Z0 + ZdX * x + ZdY * y are both
+      // evaluated at centers of pixels with integer coordinates x and y.
+      //
+      struct TriangleSetup
+      {
+        int64_t A[3];
+        int64_t B[3];
+        int64_t C[3];
+
+        int XMin;
+        int YMin;
+        int XMax;
+        int YMax;
+
+        double Z0  = 0.0;
+        double ZdX = 0.0;
+        double ZdY = 0.0;
+
+        //
+        // Planes of 1 / w and of texel coordinates divided by w, for
+        // perspective correct texturing.
+        //
+        double Q0  = 0.0;
+        double QdX = 0.0;
+        double QdY = 0.0;
+
+        double S0  = 0.0;
+        double SdX = 0.0;
+        double SdY = 0.0;
+
+        double T0  = 0.0;
+        double TdX = 0.0;
+        double TdY = 0.0;
+
+        const Sampler* Texture = nullptr;
+
+        uint32_t ColorMask = 0;
+
+        bool DepthTest = false;
+        bool Opaque    = true;
+      };
+
+      //
+      // Edge functions relative to the corner of a rectangle inside a tile.
+      // Values are small enough there to fit into 32 bits, edges that are
+      // satisfied by the whole rectangle are zeroed out.
+      //
+      struct TileEdges
+      {
+        int32_t W[3];
+        int32_t DX[3];
+        int32_t DY[3];
+
+        bool FullyCovered;
+      };
+
+      static constexpr int kBinSize = 16;
+
+      //
+      // Vertices beyond that are not handled by the fixed point rasterizer,
+      // since with 5 subpixel bits max it's what keeps edge function values
+      // inside of a tile within 32 bits.
+      //
+      static constexpr double kMaxScreenCoord = 8192.0;
+
+      static constexpr uint8_t kMaxSubpixelBits = 5;
+
+      //
+      // Returns false if triangle is degenerate after snapping or out of
+      // range, in which case it has to be drawn the old way. Texture planes
+      // are set up only if textured is given and has a texture.
+      //
+      bool SetupTriangle(const Vec3& p1,
+                         const Vec3& p2,
+                         const Vec3& p3,
+                         bool depthTest,
+                         uint32_t colorMask,
+                         TriangleSetup& ts,
+                         const PipelineItem* textured = nullptr);
+
+      //
+      // Returns false if rectangle is completely outside of the triangle.
+      //
+      bool SetupTileEdges(const TriangleSetup& ts,
+                          int x0, int y0, int x1, int y1,
+                          TileEdges& edges);
+
+      //
+      // Subpixel precise top-left rule rasterization of a single triangle
+      // over the tiles it touches. Returns false if SetupTriangle() failed.
+      //
+      bool RasterizeSubpixel(const Vec3& p1,
+                             const Vec3& p2,
+                             const Vec3& p3,
+                             bool depthTest,
+                             uint32_t colorMask);
+
+      //
+      // Clip space vertex with whatever has to be interpolated along.
+      //
+      struct ClipVertex
+      {
+        Vec4 Position;
+        Vec3 Normal;
+        Vec2 UV;
+      };
+
+      //
+      // Inside is where X * x + Y * y + Z * z + W * w + D >= 0.
+      //
+      struct ClipPlane
+      {
+        double X;
+        double Y;
+        double Z;
+        double W;
+        double D;
+      };
+
+      static constexpr ClipPlane kViewportPlanes[4] =
+      {
+        { -1.0,  0.0, 0.0, 1.0, 0.0 },
+        {  1.0,  0.0, 0.0, 1.0, 0.0 },
+        {  0.0, -1.0, 0.0, 1.0, 0.0 },
+        {  0.0,  1.0, 0.0, 1.0, 0.0 }
+      };
+
+      //
+      // Near and far planes for current projection mode. Returns false if
+      // there's no far plane.
+      //
+      bool GetDepthPlanes(ClipPlane& nearPlane, ClipPlane& farPlane) const;
+
+      //
+      // Triangle clipped by up to 6 planes can't have more vertices than
+      // that.
+      //
+      static constexpr size_t kMaxClipVertices = 12;
+
+      //
+      // Sutherland-Hodgman against a single plane, returns number of
+      // vertices written to out.
+      //
+      size_t ClipPolygon(const ClipVertex* in,
+                         size_t count,
+                         const ClipPlane& plane,
+                         ClipVertex* out) const;
+
+      //
+      // Geometry stage below doesn't touch anything but its arguments, so
+      // it's run by several threads at once. Resulting triangles go to out
+      // and problems are reported via error instead of global SW3D::Error.
+      //
+
+      //
+      // Sets pipeline state of object space triangle, shades it and returns
+      // false if it has been culled.
+      //
+      bool ShadeAndCull(Triangle& tri) const;
+
+      //
+      // Transforms, shades, culls and clips single object space triangle.
+      //
+      void ProcessTriangle(const Triangle& t,
+                           std::vector<PipelineItem>& out,
+                           EngineError& error) const;
+
+      //
+      // Projects object space triangle, clips it as necessary and pushes
+      // resulting triangle(s) into out.
+      //
+      void ProjectAndClip(const Triangle& tri,
+                          std::vector<PipelineItem>& out,
+                          EngineError& error) const;
+
+      //
+      // Second half of the above for when clip space positions of triangle
+      // are already known (first 3 vertices of polygon, which must have room
+      // for kMaxClipVertices).
+      //
+      void ClipAndSubmit(const Triangle& tri,
+                         ClipVertex* polygon,
+                         std::vector<PipelineItem>& out,
+                         EngineError& error) const;
+
+      //
+      // Clip space position of vertex number index for DrawIndexed(),
+      // transformed if it hasn't been during current call yet. Threads can
+      // race for the same vertex, whoever's first does the work.
+      //
+      const Vec4& GetTransformedVertex(int32_t index, const Vec3& position);
+
+      using GeometryJob = std::function<void(size_t begin,
+                                             size_t end,
+                                             std::vector<PipelineItem>& out,
+                                             EngineError& error)>;
+
+      //
+      // Runs job over [0, count) either right away into pipeline, or in
+      // chunks of kGeometryChunkSize in parallel, each into its own queue,
+      // which are then appended to pipeline in order.
+      //
+      void ProcessGeometry(size_t count, const GeometryJob& job);
+
+      struct GeometryQueue
+      {
+        std::vector<PipelineItem> Items;
+        EngineError Error = EngineError::OK;
+      };
+
+      static constexpr size_t kGeometryChunkSize = 4096;
+
+      //
+      // Recomputes combined matrix and camera in object space if any of the
+      // matrices has changed.
+      //
+      void UpdateTransform();
+
+      //
+      // Returns false if triangle has to be drawn the regular way.
+      //
+      bool BinTriangle(const PipelineItem& tri);
+
+      void FlushBins();
+
+      void RasterizeTile(const TriangleSetup& ts, int tileX, int tileY);
+
+      void RasterizeTileScalar(const TriangleSetup& ts,
+                               const TileEdges& edges,
+                               int x0, int y0, int x1, int y1);
+
+      //
+      // Perspective correct divide is done only every that many pixels
+      // along a span, texture coordinates are stepped linearly in between.
+      //
+      static constexpr int kTextureSubspan = 16;
+
+      void RasterizeTileTextured(const TriangleSetup& ts,
+                                 const TileEdges& edges,
+                                 int x0, int y0, int x1, int y1);
+
+#ifdef SW3D_X86
+      void RasterizeTileSSE2(const TriangleSetup& ts,
+                             const TileEdges& edges,
+                             int x0, int y0, int x1, int y1);
+
+      SW3D_TARGET_AVX2
+      void RasterizeTileAVX2(const TriangleSetup& ts,
+                             const TileEdges& edges,
+                             int x0, int y0, int x1, int y1);
+#endif
+
       void FreeTexture(int handle);
 
-      uint32_t Array2Mask(const uint8_t (&color)[4]);
+      //
+      // Fills texels and sampler of texture from its surface, false if SDL
+      // couldn't convert it.
+      //
+      static bool ConvertTexels(TextureData& td);
+
+      //
+      // z == nullptr means no depth test.
+      //
+      void RasterizeTriangle(const SDL_Point& p1,
+                             const SDL_Point& p2,
+                             const SDL_Point& p3,
+                             const double* z,
+                             uint32_t colorMask);
+
+      void RasterizePIT(const SDL_Point& p1,
+                        const SDL_Point& p2,
+                        const SDL_Point& p3,
+                        const double* z,
+                        int area,
+                        uint32_t colorMask);
+
+      void RasterizeIncremental(const SDL_Point& p1,
+                                const SDL_Point& p2,
+                                const SDL_Point& p3,
+                                const double* z,
+                                int area,
+                                uint32_t colorMask);
+
+      uint32_t Array2Mask(const uint8_t (&color)[4]) const;
 
       void DrawGrid();
 
+      bool InitFrameBufferSize(uint16_t width,
+                               uint16_t height,
+                               uint16_t qualityReductionFactor);
+      void InitBuffersAndMatrices();
+
+      void RunHeadless(bool debugMode);
+
+      void ClearColorBuffer();
+      void UploadColorBuffer();
+
       SDL_Window* _window = nullptr;
 
       SDL_Texture* _framebuffer = nullptr;
 
-      VVD _depthBuffer;
+      //
+      // Streaming texture that receives contents of _colorBuffer once per
+      // frame. It is then blended on top of _framebuffer, so anything that was
+      // drawn there with SDL_Render*() calls directly stays visible where color
+      // buffer is still transparent.
+      //
+      SDL_Texture* _colorBufferTexture = nullptr;
+
+      //
+      // Row-major CPU side color buffer in ARGB8888, which is the same layout
+      // as our HTML-like color masks, so they can be written as is.
+      //
+      std::vector<uint32_t> _colorBuffer;
+
+      DepthBuffer _depthBuffer;
 
       size_t _frameBufferSize = 0;
       size_t _fps = 0;
@@ -205,6 +898,13 @@ namespace SW3D
 
       bool _initialized        = false;
       bool _faceCullingEnabled = true;
+      bool _depthTestEnabled   = false;
+      bool _headless           = false;
+
+      size_t _framesToRender = 0;
+
+      std::string _frameDumpPrefix;
+      ImageFormat _frameDumpFormat = ImageFormat::PPM;
 
       int _textureHandleCounter = 0;
 
@@ -225,28 +925,102 @@ namespace SW3D
       std::unordered_map<std::string, int> _textureHandleByFname;
       std::unordered_map<int, TextureData> _texturesByHandle;
 
+      //
+      // See SetTexture().
+      //
+      const Sampler* _texture = nullptr;
+
       ProjectionMode _projectionMode = ProjectionMode::PERSPECTIVE;
       MatrixMode     _matrixMode     = MatrixMode::PROJECTION;
       RenderMode     _renderMode     = RenderMode::SOLID;
       CullFaceMode   _cullFaceMode   = CullFaceMode::BACK;
       ShadingMode    _shadingMode    = ShadingMode::FLAT;
+      RasterizerKind _rasterizerKind = RasterizerKind::TILED;
+      SimdLevel _simdLevel = DetectSimdLevel();
+
+      uint8_t _subpixelBits = 4;
 
       //
       // To store all translations and rotations.
       //
-      std::stack<Matrix> _modelViewStack;
+      std::array<Matrix4, Constants::kMatrixStackLimit> _modelViewStack;
+      size_t _modelViewStackSize = 0;
 
       //
       // To store all projections that may be.
       // We also need to save projection type to restore proper backface culling
       // after PopMatrix() is used.
       //
-      std::stack<std::pair<Matrix, ProjectionMode>> _projectionStack;
+      std::array<std::pair<Matrix4, ProjectionMode>,
+                 Constants::kMatrixStackLimit> _projectionStack;
+      size_t _projectionStackSize = 0;
+
+      //
+      // Only changed through SetModelViewMatrix() and SetProjectionMatrix().
+      //
+      Matrix4 _modelViewMatrix;
+      Matrix4 _projectionMatrix;
+
+      //
+      // Triangles are shaded and culled in object space, so that vertices go
+      // through only one matrix on their way to clip space. For that camera
+      // is brought into object space as well.
+      //
+      Matrix4 _mvpMatrix;
+      Vec3 _eyePosition;
+      Vec3 _eyeDirection;
+      bool _transformDirty = true;
+
+      //
+      // Largest scale along modelview's axes, object space lengths become at
+      // most that long in view space.
+      //
+      double _modelViewScale = 1.0;
+
+      //
+      // View frustum in object space (viewport sides, near and far if there
+      // is one), updated along with the above.
+      //
+      Frustum _frustum;
 
       //
       // Drawing pipeline.
       //
-      std::deque<Triangle> _pipeline;
+      std::vector<PipelineItem> _pipeline;
+
+      std::vector<GeometryQueue> _geometryQueues;
+
+      //
+      // Post-transform buffer of DrawIndexed(). Stamp tells which call
+      // vertex has been transformed for, so nothing has to be cleared
+      // between calls.
+      //
+      std::vector<Vec4> _postTransform;
+      std::vector<std::atomic<uint32_t>> _postTransformStamps;
+      uint32_t _transformStamp = 0;
+
+      //
+      // Triangles of the current batch and per tile lists of indices into it,
+      // in submission order. Kept around between frames so that nothing is
+      // reallocated once they've grown enough.
+      //
+      std::vector<TriangleSetup> _setups;
+      std::vector<std::vector<uint32_t>> _bins;
+
+      //
+      // Indices of non empty bins, these are what worker threads pick from.
+      // Tiles are disjoint, so nothing in color or depth buffer is shared
+      // between threads.
+      //
+      std::vector<uint32_t> _activeBins;
+
+      WorkerPool _workers;
+      size_t _threadCount = 0;
+
+      double _lodThreshold = 0.0;
+
+      int _binsX = 0;
+      int _binsY = 0;
   };
 
   // ***************************************************************************
@@ -0,0 +1,287 @@
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+#include "model-loader.h"
+
+const std::string kTwoObjsFilename = "models/two.obj";
+
+const std::string kDecor(80, '=');
+
+//
+// Same seed every time, so that failures can be reproduced.
+//
+std::mt19937 Rng(1);
+
+int Failures = 0;
+
+// =============================================================================
+
+void Check(bool condition, const std::string& what)
+{
+  printf("%s %s\n", condition ? "OK  " : "FAIL", what.data());
+
+  if (not condition)
+  {
+    Failures++;
+  }
+}
+
+// =============================================================================
+
+double Random(double from, double to)
+{
+  return std::uniform_real_distribution<double>(from, to)(Rng);
+}
+
+// =============================================================================
+
+SW3D::AABB RandomBox(double extent, double maxSize)
+{
+  SW3D::Vec3 c = { Random(-extent, extent),
+                   Random(-extent, extent),
+                   Random(-extent, extent) };
+
+  SW3D::Vec3 half = { Random(0.0, maxSize),
+                      Random(0.0, maxSize),
+                      Random(0.0, maxSize) };
+
+  SW3D::AABB box;
+
+  box.Add(c - half);
+  box.Add(c + half);
+
+  return box;
+}
+
+// =============================================================================
+
+SW3D::Vec4 Plane(const SW3D::Vec3& normal, const SW3D::Vec3& point)
+{
+  SW3D::Vec3 n = normal;
+
+  n.Normalize();
+
+  return SW3D::Vec4(n.X, n.Y, n.Z, -(n.X * point.X
+                                   + n.Y * point.Y
+                                   + n.Z * point.Z));
+}
+
+// =============================================================================
+
+//
+// Right angle pyramid from random point in random direction, cut by near
+// and far planes. Points inside are on the positive side of every plane.
+//
+SW3D::Frustum RandomFrustum(double extent)
+{
+  SW3D::Vec3 eye = { Random(-extent, extent),
+                     Random(-extent, extent),
+                     Random(-extent, extent) };
+
+  SW3D::Vec3 dir = { Random(-1.0, 1.0), Random(-1.0, 1.0), Random(-1.0, 1.0) };
+
+  dir.Normalize();
+
+  //
+  // Any two directions perpendicular to dir and each other will do.
+  //
+  SW3D::Vec3 a = (std::abs(dir.X) < 0.9) ? SW3D::Vec3{ 1.0, 0.0, 0.0 }
+                                         : SW3D::Vec3{ 0.0, 1.0, 0.0 };
+
+  SW3D::Vec3 u = { dir.Y * a.Z - dir.Z * a.Y,
+                   dir.Z * a.X - dir.X * a.Z,
+                   dir.X * a.Y - dir.Y * a.X };
+
+  SW3D::Vec3 v = { dir.Y * u.Z - dir.Z * u.Y,
+                   dir.Z * u.X - dir.X * u.Z,
+                   dir.X * u.Y - dir.Y * u.X };
+
+  u.Normalize();
+  v.Normalize();
+
+  SW3D::Frustum f;
+
+  f.Planes[0] = Plane(dir + u, eye);
+  f.Planes[1] = Plane(dir - u, eye);
+  f.Planes[2] = Plane(dir + v, eye);
+  f.Planes[3] = Plane(dir - v, eye);
+  f.Planes[4] = Plane(dir, eye + dir * 1.0);
+  f.Planes[5] = Plane(dir * -1.0, eye + dir * (extent * 0.5));
+
+  f.PlanesCount = 6;
+
+  return f;
+}
+
+// =============================================================================
+
+std::vector<uint32_t> BruteForce(const std::vector<SW3D::AABB>& bounds,
+                                 const SW3D::Frustum& frustum)
+{
+  std::vector<uint32_t> res;
+
+  for (uint32_t i = 0; i < bounds.size(); i++)
+  {
+    if (bounds[i].IsEmpty()
+     or frustum.Test(bounds[i]) != SW3D::FrustumTest::OUTSIDE)
+    {
+      res.push_back(i);
+    }
+  }
+
+  return res;
+}
+
+// =============================================================================
+
+void TestAgainstBruteForce(size_t itemsCount)
+{
+  const double extent = 100.0;
+
+  std::vector<SW3D::AABB> bounds(itemsCount);
+
+  for (SW3D::AABB& box : bounds)
+  {
+    box = RandomBox(extent, 3.0);
+  }
+
+  //
+  // These are everywhere.
+  //
+  for (size_t i = 0; i < itemsCount; i += 97)
+  {
+    bounds[i] = SW3D::AABB();
+  }
+
+  SW3D::BVH tree;
+
+  tree.Build(bounds);
+
+  std::string name = std::to_string(itemsCount) + " items";
+
+  Check(tree.Size() == itemsCount, "size: " + name);
+
+  std::vector<uint32_t> visible;
+
+  size_t mismatches = 0;
+  size_t found      = 0;
+
+  for (size_t i = 0; i < 100; i++)
+  {
+    SW3D::Frustum frustum = RandomFrustum(extent);
+
+    tree.Query(frustum, visible);
+
+    mismatches += (visible != BruteForce(bounds, frustum));
+    found      += visible.size();
+  }
+
+  printf("%zu items, %zu visible on average\n", itemsCount, found / 100);
+
+  Check(mismatches == 0, "query: " + name);
+
+  mismatches = 0;
+
+  for (size_t i = 0; i < 100; i++)
+  {
+    //
+    // Some move a bit, some jump to the other side of the world.
+    //
+    for (size_t j = 0; j < itemsCount / 10 + 1; j++)
+    {
+      uint32_t item = Rng() % itemsCount;
+
+      bounds[item] = (j % 4 == 0) ? RandomBox(extent, 3.0)
+                                  : RandomBox(extent, 0.1);
+
+      tree.Refit(item, bounds[item]);
+    }
+
+    SW3D::Frustum frustum = RandomFrustum(extent);
+
+    tree.Query(frustum, visible);
+
+    mismatches += (visible != BruteForce(bounds, frustum));
+  }
+
+  Check(mismatches == 0, "query after refit: " + name);
+}
+
+// =============================================================================
+
+void TestScene()
+{
+  SW3D::ModelLoader loader;
+
+  if (not loader.Load(kTwoObjsFilename))
+  {
+    Check(false, "scene: loaded");
+    return;
+  }
+
+  const SW3D::ModelLoader::Scene& scene = loader.GetScene();
+
+  SW3D::BVH tree;
+
+  tree.Build(scene);
+
+  std::vector<SW3D::AABB> bounds;
+
+  for (const auto& obj : scene.Objects)
+  {
+    bounds.push_back(obj.Bounds);
+  }
+
+  size_t mismatches = 0;
+
+  std::vector<uint32_t> visible;
+
+  for (size_t i = 0; i < 100; i++)
+  {
+    SW3D::Frustum frustum = RandomFrustum(5.0);
+
+    tree.Query(frustum, visible);
+
+    mismatches += (visible != BruteForce(bounds, frustum));
+  }
+
+  Check(tree.Size() == scene.Objects.size() and mismatches == 0,
+        "scene: objects of " + kTwoObjsFilename);
+}
+
+// =============================================================================
+
+int main()
+{
+  {
+    SW3D::BVH tree;
+
+    tree.Build(std::vector<SW3D::AABB>());
+
+    std::vector<uint32_t> visible = { 1, 2, 3 };
+
+    tree.Query(RandomFrustum(1.0), visible);
+
+    Check(tree.Size() == 0 and visible.empty(), "empty tree");
+  }
+  // ---------------------------------------------------------------------------
+  printf("%s\n", kDecor.data());
+  // ---------------------------------------------------------------------------
+  for (size_t count : { 1, 4, 5, 100, 10000 })
+  {
+    TestAgainstBruteForce(count);
+  }
+  // ---------------------------------------------------------------------------
+  printf("%s\n", kDecor.data());
+  // ---------------------------------------------------------------------------
+  TestScene();
+
+  printf("%s\n", kDecor.data());
+  printf("%d check(s) failed\n", Failures);
+
+  return (Failures == 0) ? 0 : 1;
+}
@@ -167,7 +167,7 @@ class TLR : public DrawWrapper
           // draw triangles based on those vertices using faces enumeration.
           // We'll do exactly like that when we load model from .obj file.
           //
-          tp.Points[i] = _projectionMatrix * tt.Points[i];
+          tp.Points[i] = GetProjectionMatrix() * tt.Points[i];
         }
 
         bool cf = ShouldCullFace(tp);
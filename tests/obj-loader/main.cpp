@@ -1,15 +1,600 @@
+#include <algorithm>
 #include <cstdio>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 
 #include "model-loader.h"
+#include "mesh-optimizer.h"
 #include "sw3d.h"
 
 const std::string kCubeFilename         = "models/cube.obj";
 const std::string kCubeTexturedFilename = "models/cube-textured.obj";
 const std::string kTwoObjsFilename      = "models/two.obj";
+const std::string kTeapotFilename       = "models/teapot.obj";
 
 const std::string kDecor(80, '=');
 
+//
+// Scratch files are written into current directory and removed afterwards.
+//
+const std::string kTempFilename = "obj-loader-test.obj";
+
+int Failures = 0;
+
+// =============================================================================
+
+void Check(bool condition, const std::string& what)
+{
+  printf("%s %s\n", condition ? "OK  " : "FAIL", what.data());
+
+  if (not condition)
+  {
+    Failures++;
+  }
+}
+
+// =============================================================================
+
+void WriteFile(const std::string& fname, const std::string& contents)
+{
+  //
+  // Binary, so that line endings are written exactly as given.
+  //
+  std::ofstream f(fname, std::ios::binary);
+  f << contents;
+}
+
+// =============================================================================
+
+//
+// Objects of size x size vertices grids each, with UV, so that there's
+// plenty of megabytes for the loader to split.
+//
+std::string MakeGrids(size_t objects, size_t size)
+{
+  std::string res;
+
+  char line[128];
+
+  size_t base = 1;
+
+  for (size_t o = 0; o < objects; o++)
+  {
+    res += "o Grid" + std::to_string(o) + "\n";
+
+    for (size_t y = 0; y < size; y++)
+    {
+      for (size_t x = 0; x < size; x++)
+      {
+        snprintf(line, sizeof(line),
+                 "v %.4f %.4f %zu\nvt %.4f %.4f\n",
+                 x * 0.1, y * 0.1, o,
+                 (double)x / size, (double)y / size);
+        res += line;
+      }
+    }
+
+    for (size_t y = 0; y + 1 < size; y++)
+    {
+      for (size_t x = 0; x + 1 < size; x++)
+      {
+        size_t i = base + y * size + x;
+
+        snprintf(line, sizeof(line),
+                 "f %zu/%zu %zu/%zu %zu/%zu\nf %zu/%zu %zu/%zu %zu/%zu\n",
+                 i, i, i + 1, i + 1, i + size, i + size,
+                 i + 1, i + 1, i + size + 1, i + size + 1, i + size, i + size);
+        res += line;
+      }
+    }
+
+    base += size * size;
+  }
+
+  return res;
+}
+
+// =============================================================================
+
+bool SameScene(const SW3D::ModelLoader::Scene& a,
+               const SW3D::ModelLoader::Scene& b)
+{
+  auto sameVec3 = [](const std::vector<SW3D::Vec3>& v1,
+                     const std::vector<SW3D::Vec3>& v2)
+  {
+    return std::equal(v1.begin(), v1.end(), v2.begin(), v2.end(),
+                      [](const SW3D::Vec3& p1, const SW3D::Vec3& p2)
+                      {
+                        return (p1.X == p2.X and p1.Y == p2.Y and p1.Z == p2.Z);
+                      });
+  };
+
+  bool same = sameVec3(a.Vertices, b.Vertices)
+          and sameVec3(a.Normals,  b.Normals)
+          and std::equal(a.UV.begin(), a.UV.end(), b.UV.begin(), b.UV.end(),
+                         [](const SW3D::Vec2& p1, const SW3D::Vec2& p2)
+                         {
+                           return (p1.X == p2.X and p1.Y == p2.Y);
+                         })
+          and a.Objects.size() == b.Objects.size();
+
+  for (size_t i = 0; same and i < a.Objects.size(); i++)
+  {
+    const auto& o1 = a.Objects[i];
+    const auto& o2 = b.Objects[i];
+
+    same = (o1.Name == o2.Name and o1.Faces.size() == o2.Faces.size());
+
+    for (size_t j = 0; same and j < o1.Faces.size(); j++)
+    {
+      same = (std::memcmp(o1.Faces[j].Indices,
+                          o2.Faces[j].Indices,
+                          sizeof(o1.Faces[j].Indices)) == 0);
+    }
+  }
+
+  return same;
+}
+
+// =============================================================================
+
+void TestParserQuirks()
+{
+  //
+  // Windows line endings, comments after data, indentation, and a face
+  // that comes before any object.
+  //
+  WriteFile(kTempFilename,
+            "# exported by something\r\n"
+            "v 0 0 0\r\n"
+            "v +1 0 0 # trailing comment\r\n"
+            "\tv 0 1 0\r\n"
+            "vn 0 0 1\r\n"
+            "vt 0.5 0.5\r\n"
+            "f 1/1/1 2/1/1 3/1/1\r\n"
+            "\r\n"
+            "o Triangle\r\n"
+            "f 3 2 1 # trailing comment\r\n");
+
+  SW3D::ModelLoader loader;
+
+  bool ok = loader.Load(kTempFilename);
+
+  const SW3D::ModelLoader::Scene& scene = loader.GetScene();
+
+  Check(ok, "quirks: loaded");
+
+  Check(scene.Vertices.size() == 3
+    and scene.Normals.size()  == 1
+    and scene.UV.size()       == 1,
+        "quirks: all vertices, normals and UV");
+
+  Check(scene.Vertices.size() == 3
+    and scene.Vertices[1].X == 1.0
+    and scene.Vertices[2].Y == 1.0,
+        "quirks: coordinates");
+
+  Check(scene.Objects.size() == 2, "quirks: leading face object");
+
+  if (scene.Objects.size() == 2)
+  {
+    const auto& leading = scene.Objects[0];
+    const auto& named   = scene.Objects[1];
+
+    Check(leading.Name.empty() and leading.Faces.size() == 1,
+          "quirks: leading face is unnamed object");
+
+    Check(named.Name == "Triangle", "quirks: no CR in object name");
+
+    //
+    // Indices are stored zero based.
+    //
+    Check(named.Faces.size() == 1
+      and named.Faces[0].Indices[0][0] == 2
+      and named.Faces[0].Indices[2][0] == 0
+      and named.Faces[0].Indices[0][1] == -1,
+          "quirks: face after object");
+
+    Check(leading.Faces.size() == 1
+      and leading.Faces[0].Indices[1][0] == 1
+      and leading.Faces[0].Indices[1][1] == 0
+      and leading.Faces[0].Indices[1][2] == 0,
+          "quirks: v/t/n face");
+  }
+
+  std::remove(kTempFilename.data());
+}
+
+// =============================================================================
+
+void TestParallelLoad()
+{
+  std::string contents = MakeGrids(8, 60);
+
+  WriteFile(kTempFilename, contents);
+
+  SW3D::ModelLoader single;
+  SW3D::ModelLoader parallel;
+
+  single.SetThreadCount(1);
+  parallel.SetThreadCount(4);
+
+  bool ok = single.Load(kTempFilename) and parallel.Load(kTempFilename);
+
+  Check(ok, "parallel: loaded "
+          + std::to_string(contents.size() >> 20) + " MB");
+
+  Check(single.GetScene().Objects.size() == 8
+    and single.GetScene().Vertices.size() == 8 * 60 * 60,
+        "parallel: everything is there");
+
+  Check(SameScene(single.GetScene(), parallel.GetScene()),
+        "parallel: same as single threaded");
+
+  std::remove(kTempFilename.data());
+}
+
+// =============================================================================
+
+void TestCache()
+{
+  namespace fs = std::filesystem;
+
+  const std::string cacheFname = kTempFilename + ".sw3dmesh";
+
+  std::string contents = MakeGrids(2, 20);
+
+  WriteFile(kTempFilename, contents);
+
+  auto load = [](SW3D::ModelLoader& loader,
+                 SW3D::MeshOutput output = SW3D::MeshOutput::TRIANGLES,
+                 size_t lodLevels = 0)
+  {
+    loader.SetCacheEnabled(true);
+    loader.SetMeshOutput(output);
+    loader.SetLodLevels(lodLevels);
+
+    return loader.Load(kTempFilename);
+  };
+
+  //
+  // Source is rewritten within the same second sometimes, so its time is
+  // moved explicitly to make sure it looks changed.
+  //
+  auto rewrite = [](const std::string& newContents)
+  {
+    fs::file_time_type time = fs::last_write_time(kTempFilename);
+
+    WriteFile(kTempFilename, newContents);
+
+    fs::last_write_time(kTempFilename, time + std::chrono::hours(1));
+  };
+
+  SW3D::ModelLoader parsed;
+
+  parsed.Load(kTempFilename);
+
+  {
+    SW3D::ModelLoader loader;
+
+    Check(load(loader) and fs::exists(cacheFname), "cache: written");
+  }
+
+  //
+  // Cache that is good is not written again.
+  //
+  fs::file_time_type cacheTime = fs::last_write_time(cacheFname)
+                               - std::chrono::hours(1);
+
+  fs::last_write_time(cacheFname, cacheTime);
+
+  {
+    SW3D::ModelLoader loader;
+
+    Check(load(loader)
+      and fs::last_write_time(cacheFname) == cacheTime
+      and SameScene(loader.GetScene(), parsed.GetScene()),
+          "cache: loaded from cache");
+  }
+
+  {
+    rewrite(contents);
+
+    SW3D::ModelLoader loader;
+
+    Check(load(loader) and SameScene(loader.GetScene(), parsed.GetScene()),
+          "cache: touched source");
+  }
+
+  {
+    //
+    // Same size, different contents.
+    //
+    std::string changed = contents;
+    changed.replace(changed.find("v 0.0000"), 8, "v 9.0000");
+
+    rewrite(changed);
+
+    SW3D::ModelLoader loader;
+
+    Check(load(loader) and loader.GetScene().Vertices[0].X == 9.0,
+          "cache: changed source of same size");
+  }
+
+  {
+    rewrite(contents + "v 1 2 3\n");
+
+    SW3D::ModelLoader loader;
+
+    size_t vertices = parsed.GetScene().Vertices.size() + 1;
+
+    Check(load(loader) and loader.GetScene().Vertices.size() == vertices,
+          "cache: changed source size");
+  }
+
+  {
+    rewrite(contents);
+
+    SW3D::ModelLoader loader;
+
+    load(loader);
+
+    fs::resize_file(cacheFname, fs::file_size(cacheFname) / 2);
+
+    SW3D::ModelLoader again;
+
+    Check(load(again) and SameScene(again.GetScene(), parsed.GetScene()),
+          "cache: damaged cache");
+  }
+
+  {
+    //
+    // LODs are only built along with index buffers, cache made without
+    // them can't be used when they are wanted, and the other way around.
+    //
+    SW3D::ModelLoader triangles;
+    SW3D::ModelLoader indexed;
+    SW3D::ModelLoader trianglesAgain;
+
+    bool ok = load(triangles, SW3D::MeshOutput::TRIANGLES, 2)
+          and load(indexed, SW3D::MeshOutput::INDEXED, 2)
+          and load(trianglesAgain, SW3D::MeshOutput::TRIANGLES, 2);
+
+    Check(ok
+      and triangles.GetScene().Objects[0].Lods.empty()
+      and not indexed.GetScene().Objects[0].Lods.empty()
+      and trianglesAgain.GetScene().Objects[0].Lods.empty()
+      and not trianglesAgain.GetScene().Objects[0].Triangles.empty(),
+          "cache: mesh output and LODs");
+  }
+
+  std::remove(kTempFilename.data());
+  std::remove(cacheFname.data());
+}
+
+// =============================================================================
+
+void TestIndexedOutput(const std::string& fname)
+{
+  SW3D::ModelLoader triangles;
+  SW3D::ModelLoader indexed;
+
+  triangles.SetMeshOutput(SW3D::MeshOutput::TRIANGLES);
+  indexed.SetMeshOutput(SW3D::MeshOutput::INDEXED);
+
+  bool ok = triangles.Load(fname)
+        and indexed.Load(fname)
+        and triangles.GetScene().Objects.size()
+         == indexed.GetScene().Objects.size();
+
+  auto same = [](const SW3D::Vertex& a, const SW3D::Vertex& b)
+  {
+    return (a.Position.X == b.Position.X
+        and a.Position.Y == b.Position.Y
+        and a.Position.Z == b.Position.Z
+        and a.Normal.X   == b.Normal.X
+        and a.Normal.Y   == b.Normal.Y
+        and a.Normal.Z   == b.Normal.Z
+        and a.UV.X       == b.UV.X
+        and a.UV.Y       == b.UV.Y);
+  };
+
+  size_t vertices = 0;
+  size_t indices  = 0;
+
+  for (size_t i = 0; ok and i < triangles.GetScene().Objects.size(); i++)
+  {
+    const auto& t = triangles.GetScene().Objects[i];
+    const auto& o = indexed.GetScene().Objects[i];
+
+    ok = (o.Triangles.empty()
+      and t.IndexBuffer.empty()
+      and o.IndexBuffer.size() == t.Triangles.size() * 3);
+
+    for (size_t j = 0; ok and j < o.IndexBuffer.size(); j++)
+    {
+      uint32_t index = o.IndexBuffer[j];
+
+      ok = (index < o.VertexBuffer.size()
+        and same(o.VertexBuffer[index], t.Triangles[j / 3].Points[j % 3]));
+    }
+
+    vertices += o.VertexBuffer.size();
+    indices  += o.IndexBuffer.size();
+  }
+
+  Check(ok, "indexed: same triangles as expanded ones in " + fname);
+
+  //
+  // Vertices shared by triangles are there only once.
+  //
+  Check(vertices < indices, "indexed: shared vertices in " + fname);
+}
+
+// =============================================================================
+
+//
+// Triangles of indexed mesh as coordinates of their corners, sorted, so
+// that meshes can be compared regardless of triangle and vertex order.
+//
+std::vector<std::array<double, 9>> SortedTriangles(
+    const SW3D::ModelLoader::Scene::Object& obj)
+{
+  std::vector<std::array<double, 9>> res;
+
+  for (size_t i = 0; i + 2 < obj.IndexBuffer.size(); i += 3)
+  {
+    std::array<double, 9> t;
+
+    for (size_t j = 0; j < 3; j++)
+    {
+      const SW3D::Vec3& p = obj.VertexBuffer[obj.IndexBuffer[i + j]].Position;
+
+      t[j * 3 + 0] = p.X;
+      t[j * 3 + 1] = p.Y;
+      t[j * 3 + 2] = p.Z;
+    }
+
+    res.push_back(t);
+  }
+
+  std::sort(res.begin(), res.end());
+
+  return res;
+}
+
+// =============================================================================
+
+void TestVertexCacheOptimization()
+{
+  SW3D::ModelLoader original;
+  SW3D::ModelLoader optimized;
+
+  original.SetMeshOutput(SW3D::MeshOutput::INDEXED);
+  optimized.SetMeshOutput(SW3D::MeshOutput::INDEXED);
+  optimized.SetOptimizeVertexCache(true);
+
+  bool ok = original.Load(kTeapotFilename)
+        and optimized.Load(kTeapotFilename);
+
+  Check(ok, "acmr: loaded");
+
+  if (not ok)
+  {
+    return;
+  }
+
+  const auto& o1 = original.GetScene().Objects[0];
+  const auto& o2 = optimized.GetScene().Objects[0];
+
+  printf("teapot ACMR %.3f -> %.3f\n", o2.ACMRBefore, o2.ACMRAfter);
+
+  double before = SW3D::ComputeACMR(o1.IndexBuffer, o1.VertexBuffer.size());
+  double after  = SW3D::ComputeACMR(o2.IndexBuffer, o2.VertexBuffer.size());
+
+  Check(std::abs(o2.ACMRBefore - before) < 1e-9
+    and std::abs(o2.ACMRAfter  - after)  < 1e-9,
+        "acmr: reported values");
+
+  //
+  // Tipsify gets well under 0.8 on it, while file order is close to 1.
+  //
+  Check(o2.ACMRAfter < o2.ACMRBefore * 0.8, "acmr: improved");
+
+  Check(SortedTriangles(o1) == SortedTriangles(o2), "acmr: same triangles");
+
+  Check(o2.VertexBuffer.size() == o1.VertexBuffer.size(),
+        "acmr: same vertices");
+}
+
+// =============================================================================
+
+void TestLods()
+{
+  auto load = [](SW3D::ModelLoader& loader,
+                 const std::string& fname,
+                 size_t levels)
+  {
+    loader.SetMeshOutput(SW3D::MeshOutput::INDEXED);
+    loader.SetOptimizeVertexCache(true);
+    loader.SetLodLevels(levels);
+
+    return (loader.Load(fname) and not loader.GetScene().Objects.empty());
+  };
+
+  SW3D::ModelLoader teapot;
+
+  if (not load(teapot, kTeapotFilename, 4))
+  {
+    Check(false, "lods: loaded");
+    return;
+  }
+
+  const auto& obj = teapot.GetScene().Objects[0];
+
+  printf("teapot triangles %zu", obj.IndexBuffer.size() / 3);
+
+  for (const auto& lod : obj.Lods)
+  {
+    printf(" -> %zu", lod.size() / 3);
+  }
+
+  printf("\n");
+
+  //
+  // 6320 -> 1580 -> 394 -> 176 at the time of writing.
+  //
+  Check(obj.Lods.size() >= 2 and obj.Lods.size() <= 4, "lods: count");
+
+  bool fewer = true;
+  bool valid = true;
+
+  size_t prev = obj.IndexBuffer.size() / 3;
+
+  for (const auto& lod : obj.Lods)
+  {
+    size_t count = lod.size() / 3;
+
+    fewer = fewer and (count <= prev * 3 / 4) and (count != 0);
+
+    for (size_t i = 0; i + 2 < lod.size(); i += 3)
+    {
+      valid = valid
+          and lod[i]     < obj.VertexBuffer.size()
+          and lod[i + 1] < obj.VertexBuffer.size()
+          and lod[i + 2] < obj.VertexBuffer.size()
+          and lod[i] != lod[i + 1]
+          and lod[i] != lod[i + 2]
+          and lod[i + 1] != lod[i + 2];
+    }
+
+    prev = count;
+  }
+
+  Check(fewer, "lods: each one is simpler than the previous");
+  Check(valid, "lods: no bad or degenerate triangles");
+
+  size_t full  = obj.IndexBuffer.size() / 3;
+  size_t first = obj.Lods.empty() ? 0 : obj.Lods[0].size() / 3;
+
+  Check(first >= full / 8 and first <= full * 3 / 8,
+        "lods: first one has 1/8 to 3/8 of triangles");
+
+  SW3D::ModelLoader one;
+  SW3D::ModelLoader cube;
+
+  Check(load(one, kTeapotFilename, 1)
+    and one.GetScene().Objects[0].Lods.size() == 1
+    and one.GetScene().Objects[0].Lods[0] == obj.Lods[0],
+        "lods: only as many as requested");
+
+  Check(load(cube, kCubeFilename, 4)
+    and cube.GetScene().Objects[0].Lods.empty(),
+        "lods: none for tiny meshes");
+}
+
 // =============================================================================
 
 int main(int argc, char* argv[])
@@ -45,6 +630,19 @@ int main(int argc, char* argv[])
       printf("%s\n", SW3D::ErrorToString());
     }
   }
+  // ---------------------------------------------------------------------------
+  printf("%s\n", kDecor.data());
+  // ---------------------------------------------------------------------------
+  TestParserQuirks();
+  TestParallelLoad();
+  TestCache();
+  TestIndexedOutput(kCubeTexturedFilename);
+  TestIndexedOutput(kTeapotFilename);
+  TestVertexCacheOptimization();
+  TestLods();
+
+  printf("%s\n", kDecor.data());
+  printf("%d check(s) failed\n", Failures);
 
-  return 0;
+  return (Failures == 0) ? 0 : 1;
 }
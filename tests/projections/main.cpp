@@ -0,0 +1,300 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "sw3d.h"
+#include "bvh.h"
+
+using namespace SW3D;
+
+const std::string kTeapotFilename = "models/teapot.obj";
+
+const std::string kDecor(80, '=');
+
+//
+// Same view as in "Rendering pipeline" scene of the demo.
+//
+const double InitialTranslation = 5.0;
+const double OrthographicDepth  = InitialTranslation * 4.0;
+
+const uint16_t kCanvasSize = 256;
+
+const std::vector<std::pair<ProjectionMode, std::string>> ProjectionModes =
+{
+  { ProjectionMode::ORTHOGRAPHIC,     "orthographic"     },
+  { ProjectionMode::WEAK_PERSPECTIVE, "weak perspective" },
+  { ProjectionMode::PERSPECTIVE,      "perspective"      }
+};
+
+int Failures = 0;
+
+// =============================================================================
+
+void Check(bool condition, const std::string& what)
+{
+  printf("%s %s\n", condition ? "OK  " : "FAIL", what.data());
+
+  if (not condition)
+  {
+    Failures++;
+  }
+}
+
+// =============================================================================
+
+//
+// Renders one frame of loaded model per Run() with current settings.
+//
+class Drawer : public DrawWrapper
+{
+  public:
+    ProjectionMode Projection = ProjectionMode::PERSPECTIVE;
+
+    double Distance = InitialTranslation;
+
+    bool DepthTest = false;
+    DepthFormat DepthFormat_ = DepthFormat::FLOAT32;
+
+    RasterizerKind Rasterizer = RasterizerKind::TILED;
+
+    ModelLoader Loader;
+    BVH Tree;
+
+    // -------------------------------------------------------------------------
+
+    //
+    // Pixels that aren't of clear color.
+    //
+    size_t CountDrawn() const
+    {
+      const std::vector<uint32_t>& colors = GetColorBuffer();
+
+      size_t res = 0;
+
+      for (uint32_t c : colors)
+      {
+        res += (c != colors[0]);
+      }
+
+      return res;
+    }
+
+  protected:
+    void DrawToFrameBuffer() override
+    {
+      SetMatrixMode(MatrixMode::PROJECTION);
+
+      switch (Projection)
+      {
+        case ProjectionMode::ORTHOGRAPHIC:
+          SetOrthographic(-InitialTranslation * 0.5,  InitialTranslation * 0.5,
+                           InitialTranslation * 0.5, -InitialTranslation * 0.5,
+                           OrthographicDepth,        -OrthographicDepth);
+          break;
+
+        case ProjectionMode::WEAK_PERSPECTIVE:
+          SetWeakPerspective();
+          break;
+
+        case ProjectionMode::PERSPECTIVE:
+          SetPerspective(60.0, 1.0, 0.1, 1000.0);
+          break;
+      }
+
+      SetMatrixMode(MatrixMode::MODELVIEW);
+
+      if (GetDepthBuffer().Format() != DepthFormat_)
+      {
+        SetDepthFormat(DepthFormat_);
+      }
+
+      if (DepthTest)
+      {
+        ClearDepthBuffer();
+      }
+
+      SetDepthTestEnabled(DepthTest);
+      SetRasterizerKind(Rasterizer);
+
+      PushMatrix();
+
+      RotateY(30.0);
+      RotateX(15.0);
+
+      Translate(0.0, 0.0, Distance);
+
+      std::vector<uint32_t> visible;
+
+      Tree.Query(GetFrustum(), visible);
+
+      for (uint32_t i : visible)
+      {
+        DrawIndexed(Loader.GetScene(), Loader.GetScene().Objects[i]);
+      }
+
+      PopMatrix();
+
+      CommenceDraw();
+    }
+
+    void HandleEvent(const SDL_Event&) override
+    {
+    }
+};
+
+// =============================================================================
+
+//
+// Before triangles got clipped against near and far planes (and objects
+// culled against view frustum) all of these were drawn.
+//
+void TestVisibleObjects(Drawer& d)
+{
+  for (auto& [mode, name] : ProjectionModes)
+  {
+    for (double distance : { 2.0, InitialTranslation, InitialTranslation * 2 })
+    {
+      d.Projection = mode;
+      d.Distance   = distance;
+
+      d.Run();
+
+      size_t drawn = d.CountDrawn();
+
+      char buf[128];
+      snprintf(buf, sizeof(buf),
+               "%s: teapot at Z = %.1f is drawn (%zu pixels)",
+               name.data(), distance, drawn);
+
+      Check(drawn != 0, buf);
+    }
+  }
+}
+
+// =============================================================================
+
+//
+// Teapot is big enough along Z for any of the formats to sort it out the
+// same way FLOAT32 does, as long as the whole [0 ; 1] range is used. For
+// orthographic projection it's put around Z = 0, so that it gets into both
+// halves of [-1 ; 1] before mapping.
+//
+void TestDepthFormats(Drawer& d)
+{
+  const std::vector<std::pair<DepthFormat, std::string>> formats =
+  {
+    { DepthFormat::UNORM24, "UNORM24" },
+    { DepthFormat::UNORM16, "UNORM16" }
+  };
+
+  d.DepthTest = true;
+
+  for (auto& [mode, name] : ProjectionModes)
+  {
+    if (mode == ProjectionMode::WEAK_PERSPECTIVE)
+    {
+      continue;
+    }
+
+    d.Projection   = mode;
+    d.Distance     = (mode == ProjectionMode::ORTHOGRAPHIC)
+                     ? 0.0
+                     : InitialTranslation;
+    d.DepthFormat_ = DepthFormat::FLOAT32;
+
+    d.Run();
+
+    std::vector<uint32_t> reference = d.GetColorBuffer();
+
+    for (auto& [format, formatName] : formats)
+    {
+      d.DepthFormat_ = format;
+
+      d.Run();
+
+      const std::vector<uint32_t>& colors = d.GetColorBuffer();
+
+      size_t mismatches = 0;
+
+      for (size_t i = 0; i < colors.size(); i++)
+      {
+        mismatches += (colors[i] != reference[i]);
+      }
+
+      char buf[128];
+      snprintf(buf, sizeof(buf),
+               "%s: %s depth draws the same as FLOAT32 (%zu mismatches)",
+               name.data(), formatName.data(), mismatches);
+
+      Check(mismatches == 0, buf);
+    }
+  }
+
+  d.DepthTest    = false;
+  d.DepthFormat_ = DepthFormat::FLOAT32;
+}
+
+// =============================================================================
+
+//
+// Both compute depth of every pixel from edge functions, so with depth test
+// on they still have to agree on every pixel.
+//
+void TestIncrementalRasterizer(Drawer& d)
+{
+  d.DepthTest = true;
+
+  for (auto& [mode, name] : ProjectionModes)
+  {
+    d.Projection = mode;
+    d.Distance   = (mode == ProjectionMode::ORTHOGRAPHIC)
+                   ? 0.0
+                   : InitialTranslation;
+    d.Rasterizer = RasterizerKind::PIT;
+
+    d.Run();
+
+    std::vector<uint32_t> reference = d.GetColorBuffer();
+
+    d.Rasterizer = RasterizerKind::INCREMENTAL;
+
+    d.Run();
+
+    Check(d.GetColorBuffer() == reference,
+          name + ": INCREMENTAL with depth test draws the same as PIT");
+  }
+
+  d.DepthTest  = false;
+  d.Rasterizer = RasterizerKind::TILED;
+}
+
+// =============================================================================
+
+int main()
+{
+  Drawer d;
+
+  if (not d.InitHeadless(kCanvasSize, kCanvasSize, 1)
+   or not d.Loader.Load(kTeapotFilename))
+  {
+    printf("%s\n", SW3D::ErrorToString());
+    return 1;
+  }
+
+  d.Tree.Build(d.Loader.GetScene());
+
+  TestVisibleObjects(d);
+
+  printf("%s\n", kDecor.data());
+
+  TestDepthFormats(d);
+
+  printf("%s\n", kDecor.data());
+
+  TestIncrementalRasterizer(d);
+
+  printf("%s\n", kDecor.data());
+  printf("%d check(s) failed\n", Failures);
+
+  return (Failures == 0) ? 0 : 1;
+}
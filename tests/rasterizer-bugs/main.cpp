@@ -150,7 +150,7 @@ class TLR : public DrawWrapper
 
         for (size_t i = 0; i < 3; i++)
         {
-          tp.Points[i] = _projectionMatrix * tt.Points[i];
+          tp.Points[i] = GetProjectionMatrix() * tt.Points[i];
 
           tp.Points[i].X += 1;
           tp.Points[i].Y += 1;
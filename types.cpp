@@ -1,9 +1,61 @@
 #include "types.h"
 
+#include <algorithm>
+
 namespace SW3D
 {
   EngineError Error = EngineError::NOT_INITIALIZED;
 
+  // ---------------------------------------------------------------------------
+
+  SimdLevel DetectSimdLevel()
+  {
+#ifdef SW3D_X86
+  #ifdef _MSC_VER
+    int regs[4];
+
+    __cpuid(regs, 0);
+    int maxLeaf = regs[0];
+
+    __cpuid(regs, 1);
+
+    bool sse2    = (regs[3] & (1 << 26));
+    bool osxsave = (regs[2] & (1 << 27));
+    bool avx     = (regs[2] & (1 << 28));
+
+    bool avx2 = false;
+
+    //
+    // AVX state has to be enabled by OS as well.
+    //
+    if (maxLeaf >= 7 and osxsave and avx and (_xgetbv(0) & 0x6) == 0x6)
+    {
+      __cpuidex(regs, 7, 0);
+      avx2 = (regs[1] & (1 << 5));
+    }
+  #else
+    __builtin_cpu_init();
+
+    bool sse2 = __builtin_cpu_supports("sse2");
+    bool avx2 = __builtin_cpu_supports("avx2");
+  #endif
+
+    if (avx2)
+    {
+      return SimdLevel::AVX2;
+    }
+
+    if (sse2)
+    {
+      return SimdLevel::SSE2;
+    }
+#endif
+
+    return SimdLevel::SCALAR;
+  }
+
+  // ---------------------------------------------------------------------------
+
   const char* ErrorToString()
   {
     switch (Error)
@@ -32,6 +84,9 @@ namespace SW3D
       case EngineError::FAILED_TO_LOAD_MODEL:
         return "Failed to load model from file";
 
+      case EngineError::FAILED_TO_SAVE_IMAGE:
+        return "Failed to save image to file";
+
       case EngineError::NOT_INITIALIZED:
         return "Engine was not initialized";
 
@@ -51,6 +106,92 @@ namespace SW3D
 
   // ===========================================================================
 
+  void AABB::Add(const Vec3& p)
+  {
+    Min.X = std::min(Min.X, p.X);
+    Min.Y = std::min(Min.Y, p.Y);
+    Min.Z = std::min(Min.Z, p.Z);
+
+    Max.X = std::max(Max.X, p.X);
+    Max.Y = std::max(Max.Y, p.Y);
+    Max.Z = std::max(Max.Z, p.Z);
+  }
+
+  bool AABB::IsEmpty() const
+  {
+    return (Min.X > Max.X or Min.Y > Max.Y or Min.Z > Max.Z);
+  }
+
+  // ===========================================================================
+
+  FrustumTest Frustum::Test(const AABB& box) const
+  {
+    FrustumTest res = FrustumTest::INSIDE;
+
+    for (size_t i = 0; i < PlanesCount; i++)
+    {
+      const Vec4& p = Planes[i];
+
+      //
+      // Corners of the box furthest along plane's normal and against it.
+      // If the first one is outside, so is the whole box, if the second
+      // one is inside, so is the whole box.
+      //
+      double furthest = p.X * ((p.X >= 0.0) ? box.Max.X : box.Min.X)
+                      + p.Y * ((p.Y >= 0.0) ? box.Max.Y : box.Min.Y)
+                      + p.Z * ((p.Z >= 0.0) ? box.Max.Z : box.Min.Z)
+                      + p.W;
+
+      if (furthest < 0.0)
+      {
+        return FrustumTest::OUTSIDE;
+      }
+
+      double nearest = p.X * ((p.X >= 0.0) ? box.Min.X : box.Max.X)
+                     + p.Y * ((p.Y >= 0.0) ? box.Min.Y : box.Max.Y)
+                     + p.Z * ((p.Z >= 0.0) ? box.Min.Z : box.Max.Z)
+                     + p.W;
+
+      if (nearest < 0.0)
+      {
+        res = FrustumTest::INTERSECTS;
+      }
+    }
+
+    return res;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  FrustumTest Frustum::Test(const BoundingSphere& sphere) const
+  {
+    FrustumTest res = FrustumTest::INSIDE;
+
+    for (size_t i = 0; i < PlanesCount; i++)
+    {
+      const Vec4& p = Planes[i];
+
+      double d = p.X * sphere.Center.X
+               + p.Y * sphere.Center.Y
+               + p.Z * sphere.Center.Z
+               + p.W;
+
+      if (d < -sphere.Radius)
+      {
+        return FrustumTest::OUTSIDE;
+      }
+
+      if (d < sphere.Radius)
+      {
+        res = FrustumTest::INTERSECTS;
+      }
+    }
+
+    return res;
+  }
+
+  // ===========================================================================
+
   Vec2 Vec2::operator+(const Vec2& rhs) const
   {
     return { X + rhs.X, Y + rhs.Y };
@@ -477,4 +618,252 @@ namespace SW3D
   {
     return _cols;
   }
+
+  // ===========================================================================
+
+  //
+  // Checked once, products are way too cheap to ask CPU every time.
+  //
+  static const SimdLevel& Matrix4SimdLevel()
+  {
+    static const SimdLevel level = DetectSimdLevel();
+    return level;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void Matrix4::SetIdentity()
+  {
+    *this = Identity();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  Matrix4 Matrix4::operator*(const Matrix4& rhs) const
+  {
+    Matrix4 res;
+
+#ifdef SW3D_X86
+    switch (Matrix4SimdLevel())
+    {
+      case SimdLevel::AVX2:
+        MultiplyAVX(_m.data(), rhs._m.data(), res._m.data());
+        return res;
+
+      case SimdLevel::SSE2:
+        MultiplySSE2(_m.data(), rhs._m.data(), res._m.data());
+        return res;
+
+      default:
+        break;
+    }
+#endif
+
+    for (uint32_t x = 0; x < 4; x++)
+    {
+      for (uint32_t y = 0; y < 4; y++)
+      {
+        double sum = _m[x * 4] * rhs._m[y];
+
+        for (uint32_t z = 1; z < 4; z++)
+        {
+          sum += _m[x * 4 + z] * rhs._m[z * 4 + y];
+        }
+
+        res._m[x * 4 + y] = sum;
+      }
+    }
+
+    return res;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  Vec4 Matrix4::operator*(const Vec4& in) const
+  {
+#ifdef SW3D_X86
+    if (Matrix4SimdLevel() == SimdLevel::AVX2)
+    {
+      return MultiplyAVX(_m.data(), in);
+    }
+#endif
+
+    Vec4 res;
+
+    res.X = in.X * _m[0] + in.Y * _m[4] + in.Z * _m[8]  + in.W * _m[12];
+    res.Y = in.X * _m[1] + in.Y * _m[5] + in.Z * _m[9]  + in.W * _m[13];
+    res.Z = in.X * _m[2] + in.Y * _m[6] + in.Z * _m[10] + in.W * _m[14];
+    res.W = in.X * _m[3] + in.Y * _m[7] + in.Z * _m[11] + in.W * _m[15];
+
+    return res;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  Vec3 Matrix4::operator*(const Vec3& in) const
+  {
+    //
+    // x * 1.0 == x, so this is exactly what Matrix does with implicit w.
+    //
+    Vec4 h = *this * Vec4(in.X, in.Y, in.Z, 1.0);
+
+    Vec3 res = { h.X, h.Y, h.Z };
+
+    if (h.W != 0.0)
+    {
+      res.X /= h.W;
+      res.Y /= h.W;
+      res.Z /= h.W;
+    }
+    else
+    {
+      Error = EngineError::DIVISION_BY_ZERO;
+    }
+
+    return res;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool Matrix4::operator==(const Matrix4& rhs) const
+  {
+    return (_m == rhs._m);
+  }
+
+  bool Matrix4::operator!=(const Matrix4& rhs) const
+  {
+    return (_m != rhs._m);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  Matrix4 Matrix4::Orthographic(double left, double right,
+                                double top,  double bottom,
+                                double near, double far)
+  {
+    Matrix4 m = Identity();
+
+    if ( (right - left   == 0.0)
+      or (top   - bottom == 0.0)
+      or (far   - near   == 0.0) )
+    {
+      SW3D::Error = EngineError::DIVISION_BY_ZERO;
+      return m;
+    }
+
+    m[0][0] = 2.0               / (right - left);
+    m[0][3] = -( (right + left) / (right - left) );
+    m[1][1] = 2.0               / (top   - bottom);
+    m[1][3] = -( (top + bottom) / (top   - bottom) );
+    m[2][2] = -2.0              / (far   - near);
+    m[2][3] = -( (far + near)   / (far   - near) );
+    m[3][3] = 1.0;
+
+    return m;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  Matrix4 Matrix4::WeakPerspective()
+  {
+    Matrix4 m = Identity();
+
+    m[2][3] = 1.0;
+    m[3][3] = 0.0;
+
+    return m;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  Matrix4 Matrix4::Perspective(double fov,
+                               double aspectRatio,
+                               double zNear,
+                               double zFar)
+  {
+    Matrix4 m = Identity();
+
+    double f = 1.0 / std::tan( (fov * 0.5) * Constants::DEG2RAD );
+    double q = zFar / (zFar - zNear);
+
+    m[0][0] = (f / aspectRatio);
+    m[1][1] = f;
+    m[2][2] = q;
+    m[3][2] = -zNear * q;
+    m[2][3] = 1.0;
+    m[3][3] = 0.0;
+
+    return m;
+  }
+
+  // ---------------------------------------------------------------------------
+
+#ifdef SW3D_X86
+  //
+  // With row vectors every row of the result is a linear combination of rhs
+  // rows: res[i] = a[i][0] * b[0] + a[i][1] * b[1] + ... , so it's just
+  // broadcasts, multiplies and adds over whole rows.
+  //
+  void Matrix4::MultiplySSE2(const double* a, const double* b, double* res)
+  {
+    for (int i = 0; i < 4; i++)
+    {
+      __m128d lo = _mm_mul_pd(_mm_set1_pd(a[i * 4]), _mm_loadu_pd(b));
+      __m128d hi = _mm_mul_pd(_mm_set1_pd(a[i * 4]), _mm_loadu_pd(b + 2));
+
+      for (int k = 1; k < 4; k++)
+      {
+        __m128d s = _mm_set1_pd(a[i * 4 + k]);
+
+        lo = _mm_add_pd(lo, _mm_mul_pd(s, _mm_loadu_pd(b + k * 4)));
+        hi = _mm_add_pd(hi, _mm_mul_pd(s, _mm_loadu_pd(b + k * 4 + 2)));
+      }
+
+      _mm_storeu_pd(res + i * 4,     lo);
+      _mm_storeu_pd(res + i * 4 + 2, hi);
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  SW3D_TARGET_AVX2
+  void Matrix4::MultiplyAVX(const double* a, const double* b, double* res)
+  {
+    __m256d rows[4] =
+    {
+      _mm256_loadu_pd(b),
+      _mm256_loadu_pd(b + 4),
+      _mm256_loadu_pd(b + 8),
+      _mm256_loadu_pd(b + 12)
+    };
+
+    for (int i = 0; i < 4; i++)
+    {
+      __m256d r = _mm256_mul_pd(_mm256_set1_pd(a[i * 4]), rows[0]);
+
+      r = _mm256_add_pd(r, _mm256_mul_pd(_mm256_set1_pd(a[i * 4 + 1]), rows[1]));
+      r = _mm256_add_pd(r, _mm256_mul_pd(_mm256_set1_pd(a[i * 4 + 2]), rows[2]));
+      r = _mm256_add_pd(r, _mm256_mul_pd(_mm256_set1_pd(a[i * 4 + 3]), rows[3]));
+
+      _mm256_storeu_pd(res + i * 4, r);
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  SW3D_TARGET_AVX2
+  Vec4 Matrix4::MultiplyAVX(const double* m, const Vec4& in)
+  {
+    __m256d r = _mm256_mul_pd(_mm256_set1_pd(in.X), _mm256_loadu_pd(m));
+
+    r = _mm256_add_pd(r, _mm256_mul_pd(_mm256_set1_pd(in.Y), _mm256_loadu_pd(m + 4)));
+    r = _mm256_add_pd(r, _mm256_mul_pd(_mm256_set1_pd(in.Z), _mm256_loadu_pd(m + 8)));
+    r = _mm256_add_pd(r, _mm256_mul_pd(_mm256_set1_pd(in.W), _mm256_loadu_pd(m + 12)));
+
+    alignas(32) double out[4];
+    _mm256_store_pd(out, r);
+
+    return Vec4(out[0], out[1], out[2], out[3]);
+  }
+#endif
 }
@@ -2,8 +2,21 @@
 #define TYPES_H
 
 #include <vector>
+#include <array>
 #include <cstdint>
 #include <cmath>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SW3D_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SW3D_TARGET_AVX2
+#else
+#define SW3D_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
 
 namespace SW3D
 {
@@ -13,6 +26,11 @@ namespace SW3D
     constexpr double SQRT3OVER4 = 0.4330127018922193;
 
     const uint8_t kMatrixStackLimit = 32;
+
+    //
+    // FIFO size that vertex cache optimization and ACMR assume.
+    //
+    const size_t kVertexCacheSize = 16;
   }
 
   enum class ProjectionMode
@@ -48,6 +66,13 @@ namespace SW3D
     MIXED
   };
 
+  enum class FrustumTest
+  {
+    OUTSIDE = 0,
+    INTERSECTS,
+    INSIDE
+  };
+
   enum class EngineError
   {
     OK = 0,
@@ -58,7 +83,8 @@ namespace SW3D
     STACK_OVERFLOW,
     STACK_UNDERFLOW,
     INVALID_MODE,
-    FAILED_TO_LOAD_MODEL
+    FAILED_TO_LOAD_MODEL,
+    FAILED_TO_SAVE_IMAGE
   };
 
   enum class PointCaptureType
@@ -85,10 +111,49 @@ namespace SW3D
     CCW
   };
 
+  enum class ImageFormat
+  {
+    PPM = 0,
+    BMP
+  };
+
+  enum class RasterizerKind
+  {
+    PIT = 0,
+    INCREMENTAL,
+    TILED
+  };
+
+  enum class SimdLevel
+  {
+    SCALAR = 0,
+    SSE2,
+    AVX2
+  };
+
+  enum class DepthFormat
+  {
+    FLOAT32 = 0,
+    UNORM24,
+    UNORM16
+  };
+
+  enum class MeshOutput
+  {
+    TRIANGLES = 0,
+    INDEXED,
+    TRIANGLES_AND_INDEXED
+  };
+
   extern EngineError Error;
 
   const char* ErrorToString();
 
+  //
+  // Best vector instruction set current CPU (and OS) supports.
+  //
+  SimdLevel DetectSimdLevel();
+
   // ===========================================================================
 
   struct Vec2
@@ -244,7 +309,8 @@ namespace SW3D
   {
     Vertex Points[3];
 
-    bool CullFlag = false;
+    bool CullFlag      = false;
+    bool DepthTestFlag = false;
     RenderMode  RenderMode_  = RenderMode::SOLID;
     ShadingMode ShadingMode_ = ShadingMode::FLAT;
   };
@@ -261,6 +327,46 @@ namespace SW3D
     std::vector<TriangleSimple> Triangles;
   };
 
+  //
+  // Axis aligned bounding box. Empty one has Min > Max.
+  //
+  struct AABB
+  {
+    Vec3 Min = {  std::numeric_limits<double>::max(),
+                  std::numeric_limits<double>::max(),
+                  std::numeric_limits<double>::max() };
+
+    Vec3 Max = { -std::numeric_limits<double>::max(),
+                 -std::numeric_limits<double>::max(),
+                 -std::numeric_limits<double>::max() };
+
+    void Add(const Vec3& p);
+    bool IsEmpty() const;
+  };
+
+  struct BoundingSphere
+  {
+    Vec3 Center;
+    double Radius = -1.0;
+  };
+
+  //
+  // Inside is where X * x + Y * y + Z * z + W >= 0 for every plane.
+  // Plane normals are unit length, so W is distance from origin.
+  //
+  struct Frustum
+  {
+    Vec4 Planes[6];
+    size_t PlanesCount = 0;
+
+    //
+    // Both are conservative: INTERSECTS may be returned for things that
+    // are actually outside, but never the other way around.
+    //
+    FrustumTest Test(const AABB& box) const;
+    FrustumTest Test(const BoundingSphere& sphere) const;
+  };
+
   // ===========================================================================
 
   using VV = std::vector<std::vector<double>>;
@@ -937,6 +1043,101 @@ namespace SW3D
       uint32_t _rows;
       uint32_t _cols;
   };
+
+  // ===========================================================================
+
+  //
+  // Same thing as 4x4 Matrix above (row vectors, v * M), but with fixed
+  // storage, so it never touches the heap. Products are vectorized when CPU
+  // allows, but are computed in the same order as in Matrix, so results are
+  // identical to it.
+  //
+  struct alignas(32) Matrix4
+  {
+    public:
+      //
+      // Zero matrix, same as Matrix(4, 4).
+      //
+      constexpr Matrix4() : _m{} {}
+
+      constexpr Matrix4(const std::array<double, 16>& rowMajor)
+        : _m(rowMajor) {}
+
+      void SetIdentity();
+
+      constexpr const double* operator[](uint32_t row) const
+      {
+        return &_m[row * 4];
+      }
+
+      double* operator[](uint32_t row)
+      {
+        return &_m[row * 4];
+      }
+
+      // -----------------------------------------------------------------------
+
+      Matrix4 operator*(const Matrix4& rhs) const;
+
+      //
+      // Same as in Matrix: implicit w = 1 and division by resulting w.
+      //
+      Vec3 operator*(const Vec3& in) const;
+      Vec4 operator*(const Vec4& in) const;
+
+      bool operator==(const Matrix4& rhs) const;
+      bool operator!=(const Matrix4& rhs) const;
+
+      // -----------------------------------------------------------------------
+
+      static constexpr Matrix4 Identity()
+      {
+        return Matrix4({ 1.0, 0.0, 0.0, 0.0,
+                         0.0, 1.0, 0.0, 0.0,
+                         0.0, 0.0, 1.0, 0.0,
+                         0.0, 0.0, 0.0, 1.0 });
+      }
+
+      static constexpr Matrix4 Translation(double dx, double dy, double dz)
+      {
+        return Matrix4({ 1.0, 0.0, 0.0, 0.0,
+                         0.0, 1.0, 0.0, 0.0,
+                         0.0, 0.0, 1.0, 0.0,
+                         dx,  dy,  dz,  1.0 });
+      }
+
+      //
+      // See Matrix versions of these for explanations.
+      //
+      static Matrix4 Orthographic(double left, double right,
+                                  double top,  double bottom,
+                                  double near, double far);
+
+      static Matrix4 WeakPerspective();
+
+      static Matrix4 Perspective(double fov,
+                                 double aspectRatio,
+                                 double zNear,
+                                 double zFar);
+
+    private:
+#ifdef SW3D_X86
+      static void MultiplySSE2(const double* a, const double* b, double* res);
+
+      SW3D_TARGET_AVX2
+      static void MultiplyAVX(const double* a, const double* b, double* res);
+
+      SW3D_TARGET_AVX2
+      static Vec4 MultiplyAVX(const double* m, const Vec4& in);
+#endif
+
+      //
+      // Aligned so rows don't straddle cache lines, but SIMD code still uses
+      // unaligned loads and stores: compilers don't always honor extended
+      // alignment for returned temporaries.
+      //
+      alignas(32) std::array<double, 16> _m;
+  };
 }
 
 #endif // TYPES_H